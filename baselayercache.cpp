@@ -0,0 +1,93 @@
+#include "baselayercache.h"
+#include "environment.h"
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QCache>
+#include <QtCore/QDateTime>
+#include <QtCore/QMutex>
+
+#include <algorithm>
+#include <limits>
+
+class BaseLayerCache::Private
+{
+public:
+    Private(qint64 maximumBytes, int timeToLive);
+
+    struct Entry {
+        QImage image;
+        qint64 expires;
+    };
+
+    int timeToLive;
+    mutable QMutex mutex;
+    QCache<QByteArray, Entry> cache;
+    mutable QAtomicInteger<quint64> hits;
+    mutable QAtomicInteger<quint64> misses;
+};
+
+BaseLayerCache::Private::Private(qint64 maximumBytes, int timeToLive)
+    : timeToLive(timeToLive)
+    , hits(0)
+    , misses(0)
+{
+    cache.setMaxCost(static_cast<int>(std::min<qint64>(maximumBytes / 1024, std::numeric_limits<int>::max())));
+}
+
+BaseLayerCache::BaseLayerCache(qint64 maximumBytes, int timeToLive)
+    : d(new Private(maximumBytes, timeToLive))
+{
+}
+
+BaseLayerCache::~BaseLayerCache()
+{
+    delete d;
+}
+
+BaseLayerCache *BaseLayerCache::instance()
+{
+    static BaseLayerCache cache(environment("BASE_LAYER_CACHE_SIZE", 64) * Q_INT64_C(1024) * 1024,
+                                environment("BASE_LAYER_TTL", 300));
+    return &cache;
+}
+
+QImage BaseLayerCache::find(const QByteArray &key) const
+{
+    QMutexLocker locker(&d->mutex);
+    const Private::Entry *entry = d->cache.object(key);
+    if (!entry || entry->expires < QDateTime::currentMSecsSinceEpoch()) {
+        if (entry) d->cache.remove(key);
+        d->misses.fetchAndAddRelaxed(1);
+        return QImage();
+    }
+    d->hits.fetchAndAddRelaxed(1);
+    return entry->image;
+}
+
+void BaseLayerCache::insert(const QByteArray &key, const QImage &image)
+{
+    if (image.isNull() || d->timeToLive <= 0) return;
+    Private::Entry *entry = new Private::Entry;
+    entry->image = image;
+    entry->expires = QDateTime::currentMSecsSinceEpoch() + d->timeToLive * Q_INT64_C(1000);
+
+    QMutexLocker locker(&d->mutex);
+    d->cache.insert(key, entry, std::max(1, static_cast<int>(image.sizeInBytes() / 1024)));
+}
+
+void BaseLayerCache::clear()
+{
+    QMutexLocker locker(&d->mutex);
+    d->cache.clear();
+}
+
+BaseLayerCache::Statistics BaseLayerCache::statistics() const
+{
+    Statistics ret;
+    ret.hits = d->hits.loadAcquire();
+    ret.misses = d->misses.loadAcquire();
+    QMutexLocker locker(&d->mutex);
+    ret.bytes = d->cache.totalCost() * Q_INT64_C(1024);
+    ret.count = d->cache.count();
+    return ret;
+}
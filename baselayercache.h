@@ -0,0 +1,38 @@
+#ifndef BASELAYERCACHE_H
+#define BASELAYERCACHE_H
+
+#include <QtCore/QByteArray>
+#include <QtGui/QImage>
+
+// Composited tiles of whole maps, without overlays. Maps over the same
+// viewport share the base layer and only draw their overlays on a copy of
+// it. Entries are dropped after BASE_LAYER_TTL seconds, so that refreshed
+// tiles show up.
+class BaseLayerCache
+{
+public:
+    struct Statistics {
+        quint64 hits;
+        quint64 misses;
+        qint64 bytes;
+        int count;
+    };
+
+    BaseLayerCache(qint64 maximumBytes, int timeToLive);
+    ~BaseLayerCache();
+
+    static BaseLayerCache *instance();
+
+    QImage find(const QByteArray &key) const;
+    void insert(const QByteArray &key, const QImage &image);
+    void clear();
+
+    Statistics statistics() const;
+
+private:
+    Q_DISABLE_COPY(BaseLayerCache)
+    class Private;
+    Private *d;
+};
+
+#endif // BASELAYERCACHE_H
@@ -0,0 +1,13 @@
+# The local stand-in tile server and the load generator
+
+QT += httpserver
+
+INCLUDEPATH += $$PWD
+
+HEADERS += \
+    $$PWD/loadgenerator.h \
+    $$PWD/tilestandin.h
+
+SOURCES += \
+    $$PWD/loadgenerator.cpp \
+    $$PWD/tilestandin.cpp
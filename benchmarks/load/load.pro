@@ -0,0 +1,9 @@
+TEMPLATE = app
+TARGET = qstaticmap-load
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../benchmarks.pri)
+
+SOURCES += \
+    main.cpp
@@ -0,0 +1,56 @@
+#include "loadgenerator.h"
+#include "tilestandin.h"
+
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QDebug>
+#include <QtCore/QTimer>
+
+#include <QtGui/QGuiApplication>
+
+// End-to-end numbers: run a stand-in tile server for qstaticmap to fetch
+// from, or put load on a running qstaticmap.
+int main(int argc, char *argv[])
+{
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOptions({
+        { QStringLiteral("serve-tiles"), QCoreApplication::translate("main", "Run a local stand-in tile server on the given port."), QStringLiteral("port") },
+        { QStringLiteral("latency"), QCoreApplication::translate("main", "Artificial latency of the stand-in tile server."), QStringLiteral("ms"), QStringLiteral("0") },
+        { QStringLiteral("max-age"), QCoreApplication::translate("main", "Cache-Control max-age of the stand-in tile server."), QStringLiteral("seconds"), QStringLiteral("86400") },
+        { QStringLiteral("failure-rate"), QCoreApplication::translate("main", "Percentage of stand-in tile requests answered with 503."), QStringLiteral("percent"), QStringLiteral("0") },
+        { QStringLiteral("load"), QCoreApplication::translate("main", "Send requests to the url and report throughput and latency (repeatable)."), QStringLiteral("url") },
+        { QStringLiteral("requests"), QCoreApplication::translate("main", "Number of requests to send with --load."), QStringLiteral("count"), QStringLiteral("1000") },
+        { QStringLiteral("concurrency"), QCoreApplication::translate("main", "Requests in flight with --load."), QStringLiteral("count"), QStringLiteral("16") },
+    });
+    parser.process(app);
+
+    if (parser.isSet(QStringLiteral("serve-tiles"))) {
+        TileStandIn standIn;
+        standIn.setLatency(parser.value(QStringLiteral("latency")).toInt());
+        standIn.setMaxAge(parser.value(QStringLiteral("max-age")).toInt());
+        standIn.setFailureRate(parser.value(QStringLiteral("failure-rate")).toInt());
+        const int port = standIn.listen(QHostAddress::LocalHost, parser.value(QStringLiteral("serve-tiles")).toUShort());
+        if (port == -1) {
+            qWarning() << "could not listen on" << parser.value(QStringLiteral("serve-tiles"));
+            return 1;
+        }
+        qInfo().noquote() << QStringLiteral("TILE_URL=%1").arg(standIn.tileUrl());
+        return app.exec();
+    }
+    if (parser.isSet(QStringLiteral("load"))) {
+        LoadGenerator generator;
+        QList<QUrl> urls;
+        for (const QString &url : parser.values(QStringLiteral("load"))) {
+            urls.append(QUrl(url));
+        }
+        generator.setUrls(urls);
+        generator.setRequests(parser.value(QStringLiteral("requests")).toInt());
+        generator.setConcurrency(parser.value(QStringLiteral("concurrency")).toInt());
+        QObject::connect(&generator, &LoadGenerator::finished, qApp, &QCoreApplication::quit);
+        QTimer::singleShot(0, &generator, &LoadGenerator::start);
+        return app.exec();
+    }
+    parser.showHelp(1);
+}
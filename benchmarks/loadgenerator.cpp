@@ -0,0 +1,150 @@
+#include "loadgenerator.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QVector>
+
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+#include <QtNetwork/QNetworkRequest>
+
+#include <algorithm>
+#include <cmath>
+
+class LoadGenerator::Private
+{
+public:
+    Private(LoadGenerator *parent);
+    ~Private();
+
+    void issue();
+    void report();
+
+    QList<QUrl> urls;
+    int requests;
+    int concurrency;
+
+    // a manager opens at most six connections per host, so more are needed
+    // to keep the requested number of requests on the wire
+    QVector<QNetworkAccessManager *> managers;
+    QVector<int> running;
+    QElapsedTimer elapsed;
+    QVector<qint64> latencies;
+    int issued;
+    int failed;
+    qint64 bytes;
+
+private:
+    LoadGenerator *q;
+};
+
+LoadGenerator::Private::Private(LoadGenerator *parent)
+    : requests(1000)
+    , concurrency(16)
+    , issued(0)
+    , failed(0)
+    , bytes(0)
+    , q(parent)
+{
+}
+
+LoadGenerator::Private::~Private()
+{
+    qDeleteAll(managers);
+}
+
+void LoadGenerator::Private::issue()
+{
+    const int manager = static_cast<int>(std::min_element(running.constBegin(), running.constEnd()) - running.constBegin());
+    QNetworkRequest request(urls.at(issued % urls.size()));
+    issued++;
+    running[manager]++;
+    const qint64 started = elapsed.nsecsElapsed();
+    QNetworkReply *reply = managers.at(manager)->get(request);
+    QObject::connect(reply, &QNetworkReply::finished, q, [this, reply, manager, started]() {
+        latencies.append(elapsed.nsecsElapsed() - started);
+        running[manager]--;
+        if (reply->error() == QNetworkReply::NoError) {
+            bytes += reply->readAll().size();
+        } else {
+            failed++;
+            if (failed == 1) qWarning() << reply->request().url() << reply->errorString();
+        }
+        reply->deleteLater();
+
+        if (issued < requests) {
+            issue();
+        } else if (latencies.size() == requests) {
+            report();
+            emit q->finished();
+        }
+    });
+}
+
+void LoadGenerator::Private::report()
+{
+    const double seconds = elapsed.nsecsElapsed() / 1e9;
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [this](double p) {
+        const int index = std::min(latencies.size() - 1, std::max(0, static_cast<int>(std::ceil(p * latencies.size())) - 1));
+        return latencies.at(index) / 1e6;
+    };
+    qInfo().noquote() << QStringLiteral("%1 requests, %2 failed, concurrency %3, %4 s")
+                         .arg(latencies.size()).arg(failed).arg(concurrency).arg(seconds, 0, 'f', 2);
+    qInfo().noquote() << QStringLiteral("%1 req/s, %2 KiB/s")
+                         .arg(latencies.size() / seconds, 0, 'f', 1).arg(bytes / 1024.0 / seconds, 0, 'f', 1);
+    qInfo().noquote() << QStringLiteral("latency ms: p50 %1, p90 %2, p99 %3, max %4")
+                         .arg(percentile(0.5), 0, 'f', 2).arg(percentile(0.9), 0, 'f', 2)
+                         .arg(percentile(0.99), 0, 'f', 2).arg(latencies.last() / 1e6, 0, 'f', 2);
+}
+
+LoadGenerator::LoadGenerator(QObject *parent)
+    : QObject(parent)
+    , d(new Private(this))
+{
+}
+
+LoadGenerator::~LoadGenerator()
+{
+    delete d;
+}
+
+void LoadGenerator::setUrls(const QList<QUrl> &urls)
+{
+    d->urls = urls;
+}
+
+void LoadGenerator::setRequests(int requests)
+{
+    d->requests = std::max(1, requests);
+}
+
+void LoadGenerator::setConcurrency(int concurrency)
+{
+    d->concurrency = std::max(1, concurrency);
+}
+
+void LoadGenerator::start()
+{
+    if (d->urls.isEmpty()) {
+        qWarning() << "nothing to request";
+        emit finished();
+        return;
+    }
+
+    qDeleteAll(d->managers);
+    d->managers.clear();
+    for (int i = 0; i < (d->concurrency + 5) / 6; i++) {
+        d->managers.append(new QNetworkAccessManager);
+    }
+    d->running.fill(0, d->managers.size());
+    d->latencies.clear();
+    d->latencies.reserve(d->requests);
+    d->issued = 0;
+    d->failed = 0;
+    d->bytes = 0;
+    d->elapsed.start();
+    for (int i = 0; i < std::min(d->concurrency, d->requests); i++) {
+        d->issue();
+    }
+}
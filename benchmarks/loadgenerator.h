@@ -0,0 +1,32 @@
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include <QtCore/QObject>
+#include <QtCore/QUrl>
+
+// Sends a fixed number of GET requests with a fixed number in flight,
+// cycling through the given urls, and logs throughput and latency
+// percentiles when done.
+class LoadGenerator : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LoadGenerator(QObject *parent = nullptr);
+    ~LoadGenerator() override;
+
+    void setUrls(const QList<QUrl> &urls);
+    void setRequests(int requests);
+    void setConcurrency(int concurrency);
+
+public slots:
+    void start();
+
+signals:
+    void finished();
+
+private:
+    class Private;
+    Private *d;
+};
+
+#endif // LOADGENERATOR_H
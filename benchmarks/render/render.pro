@@ -0,0 +1,11 @@
+TEMPLATE = app
+TARGET = tst_bench_render
+QT += testlib
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../../qstaticmap.pri)
+include(../benchmarks.pri)
+
+SOURCES += \
+    tst_bench_render.cpp
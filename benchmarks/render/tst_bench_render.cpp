@@ -0,0 +1,291 @@
+#include "baselayercache.h"
+#include "diskcache.h"
+#include "environment.h"
+#include "imagecache.h"
+#include "imageencoder.h"
+#include "staticmap.h"
+#include "tilestandin.h"
+#include "urlqueryparser.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QVector>
+
+#include <QtGui/QFontDatabase>
+
+#include <QtTest/QtTest>
+
+#include <cmath>
+#include <functional>
+
+namespace {
+
+const Coordinate center(43.039498, 141.313663);
+
+// a spiral around the center, about a kilometer across
+QVector<Coordinate> spiral(int count)
+{
+    QVector<Coordinate> ret;
+    ret.reserve(count);
+    for (int i = 0; i < count; i++) {
+        const double t = static_cast<double>(i) / count;
+        const double angle = t * 40 * M_PI;
+        ret.append(Coordinate(center.latitude() + 0.005 * t * std::sin(angle),
+                              center.longitude() + 0.007 * t * std::cos(angle)));
+    }
+    return ret;
+}
+
+// Google's encoded polyline format, precision 5
+QString encodePolyline(const QVector<Coordinate> &coordinates)
+{
+    QString ret;
+    qint64 previous[2] = { 0, 0 };
+    for (const Coordinate &coordinate : coordinates) {
+        const qint64 values[2] = { std::llround(coordinate.latitude() * 1e5), std::llround(coordinate.longitude() * 1e5) };
+        for (int i = 0; i < 2; i++) {
+            const qint64 delta = values[i] - previous[i];
+            previous[i] = values[i];
+            quint64 bits = delta < 0 ? ~(static_cast<quint64>(delta) << 1) : static_cast<quint64>(delta) << 1;
+            while (bits >= 0x20) {
+                ret += QChar(static_cast<ushort>((0x20 | (bits & 0x1f)) + 63));
+                bits >>= 5;
+            }
+            ret += QChar(static_cast<ushort>(bits + 63));
+        }
+    }
+    return ret;
+}
+
+// spread over the map without a random generator, so every run draws the same
+Coordinate scatter(int i)
+{
+    return Coordinate(center.latitude() + ((i * 37) % 101 - 50) * 0.00004,
+                      center.longitude() + ((i * 61) % 103 - 51) * 0.00005);
+}
+
+QImage render(const QSize &size, int zoom, const std::function<void(StaticMap *)> &decorate = std::function<void(StaticMap *)>())
+{
+    StaticMap map;
+    map.setSize(size);
+    map.setZoom(zoom);
+    map.setCenter(center);
+    if (decorate) decorate(&map);
+    return map.render();
+}
+
+}
+
+// Times the render pipeline in process. Tiles come from a TileStandIn,
+// delayed by BENCH_TILE_LATENCY milliseconds, and are cached in a temporary
+// directory. Select cases the QtTest way, e.g. "render:cold/512px/z12".
+class tst_Render : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void render_data();
+    void render();
+    void path_data();
+    void path();
+    void markers_data();
+    void markers();
+    void parse_data();
+    void parse();
+    void encode_data();
+    void encode();
+
+private:
+    QTemporaryDir m_cacheDirectory;
+    TileStandIn m_standIn;
+};
+
+// Nothing in this binary touches the caches or the tile url before this,
+// so they are all set up here.
+void tst_Render::initTestCase()
+{
+    QVERIFY(m_cacheDirectory.isValid());
+    m_standIn.setLatency(environment("BENCH_TILE_LATENCY", 0));
+    QVERIFY(m_standIn.listen() >= 0);
+    qputenv("DISK_CACHE_PATH", QFile::encodeName(m_cacheDirectory.path()));
+    qputenv("TILE_URL", m_standIn.tileUrl().toUtf8());
+    QFontDatabase::addApplicationFont(":/fonts/OpenSans-Regular.ttf");
+}
+
+void tst_Render::cleanupTestCase()
+{
+    qInfo().noquote() << QStringLiteral("%1 tile requests served").arg(m_standIn.requestCount());
+}
+
+void tst_Render::render_data()
+{
+    QTest::addColumn<QString>("caches");
+    QTest::addColumn<QSize>("size");
+    QTest::addColumn<int>("zoom");
+    for (const QString &caches : { QStringLiteral("cold"), QStringLiteral("warm"), QStringLiteral("base") }) {
+        for (int width : { 256, 512, 1024 }) {
+            for (int zoom : { 4, 12, 16 }) {
+                QTest::addRow("%s/%dpx/z%d", qPrintable(caches), width, zoom) << caches << QSize(width, width) << zoom;
+            }
+        }
+    }
+}
+
+// cold: nothing cached, measured once; warm: tiles cached, the base layer
+// is dropped before every render; base: the base layer is cached
+void tst_Render::render()
+{
+    QFETCH(QString, caches);
+    QFETCH(QSize, size);
+    QFETCH(int, zoom);
+
+    ::render(size, zoom);
+    if (caches == QLatin1String("cold")) {
+        BaseLayerCache::instance()->clear();
+        ImageCache::instance()->clear();
+        DiskCache::instance()->clear();
+        QBENCHMARK_ONCE {
+            ::render(size, zoom);
+        }
+    } else if (caches == QLatin1String("warm")) {
+        QBENCHMARK {
+            BaseLayerCache::instance()->clear();
+            ::render(size, zoom);
+        }
+    } else {
+        QBENCHMARK {
+            ::render(size, zoom);
+        }
+    }
+}
+
+void tst_Render::path_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<bool>("closed");
+    for (int count : { 10, 100, 1000, 10000, 100000 }) {
+        QTest::addRow("polygon/%d", count) << count << true;
+        QTest::addRow("polyline/%d", count) << count << false;
+    }
+}
+
+void tst_Render::path()
+{
+    QFETCH(int, count);
+    QFETCH(bool, closed);
+
+    StaticMap::Path path;
+    path.coordinates = spiral(count);
+    path.border.color = Qt::blue;
+    path.border.width = 3;
+    path.closed = closed;
+    if (closed) {
+        path.color = QColor(0, 0, 255, 64);
+    }
+    auto decorate = [&path](StaticMap *map) { map->addPath(path); };
+    ::render(QSize(512, 512), 14, decorate);
+    QBENCHMARK {
+        ::render(QSize(512, 512), 14, decorate);
+    }
+}
+
+void tst_Render::markers_data()
+{
+    QTest::addColumn<QString>("kind");
+    QTest::addColumn<int>("count");
+    for (const QString &kind : { QStringLiteral("icons"), QStringLiteral("pins"), QStringLiteral("labels") }) {
+        for (int count : { 100, 1000 }) {
+            QTest::addRow("%s/%d", qPrintable(kind), count) << kind << count;
+        }
+    }
+}
+
+void tst_Render::markers()
+{
+    QFETCH(QString, kind);
+    QFETCH(int, count);
+
+    const QUrl icon(m_standIn.iconUrl());
+    auto decorate = [&](StaticMap *map) {
+        for (int i = 0; i < count; i++) {
+            if (kind == QLatin1String("labels")) {
+                map->addText({ QString::number(i), scatter(i) });
+                continue;
+            }
+            StaticMap::Image image;
+            if (kind == QLatin1String("icons")) {
+                image.url = icon;
+            } else {
+                image.label = QLatin1Char('A' + i % 26);
+            }
+            image.coordinate = scatter(i);
+            map->addImage(image);
+        }
+    };
+    ::render(QSize(512, 512), 16, decorate);
+    QBENCHMARK {
+        ::render(QSize(512, 512), 16, decorate);
+    }
+}
+
+void tst_Render::parse_data()
+{
+    QTest::addColumn<QString>("value");
+    QTest::addColumn<int>("count");
+    for (int count : { 1000, 100000 }) {
+        QString path = QStringLiteral("color:0x0000ffff|weight:3|fillcolor:0x0000ff40");
+        for (const Coordinate &coordinate : spiral(count)) {
+            path += QStringLiteral("|%1,%2").arg(coordinate.latitude(), 0, 'f', 6).arg(coordinate.longitude(), 0, 'f', 6);
+        }
+        QTest::addRow("path/%d", count) << path << count;
+        QTest::addRow("enc/%d", count) << QStringLiteral("color:0x0000ffff|weight:3|enc:") + encodePolyline(spiral(count)) << count;
+    }
+}
+
+void tst_Render::parse()
+{
+    QFETCH(QString, value);
+    QFETCH(int, count);
+
+    int coordinates = 0;
+    QBENCHMARK {
+        coordinates = 0;
+        UrlQueryParser::parse(value, [](QStringView, QStringView) {}, [&coordinates](const Coordinate &) {
+            coordinates++;
+        });
+    }
+    QCOMPARE(coordinates, count);
+}
+
+void tst_Render::encode_data()
+{
+    QTest::addColumn<QString>("format");
+    QTest::addColumn<int>("width");
+    for (const QString &format : { QStringLiteral("png"), QStringLiteral("png8"), QStringLiteral("jpg"), QStringLiteral("webp") }) {
+        for (int width : { 512, 1024 }) {
+            QTest::addRow("%s/%dpx", qPrintable(format), width) << format << width;
+        }
+    }
+}
+
+void tst_Render::encode()
+{
+    QFETCH(QString, format);
+    QFETCH(int, width);
+
+    ImageEncoder encoder;
+    if (!encoder.setFormat(format)) {
+        QSKIP("format not supported");
+    }
+    const QImage image = ::render(QSize(width, width), 16);
+    QByteArray data;
+    QBENCHMARK {
+        QVERIFY(encoder.encode(image, &data));
+    }
+}
+
+QTEST_MAIN(tst_Render)
+#include "tst_bench_render.moc"
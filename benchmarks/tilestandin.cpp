@@ -0,0 +1,199 @@
+#include "tilestandin.h"
+
+#include <QtCore/QBuffer>
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QTimer>
+#include <QtCore/QUrlQuery>
+
+#include <QtGui/QImage>
+#include <QtGui/QPainter>
+
+#include <QtHttpServer/QHttpServer>
+#include <QtHttpServer/QHttpServerRequest>
+#include <QtHttpServer/QHttpServerResponder>
+#include <QtHttpServer/QHttpServerResponse>
+
+#include <algorithm>
+
+namespace {
+
+QByteArray toPng(const QImage &image)
+{
+    QByteArray ret;
+    QBuffer buffer(&ret);
+    buffer.open(QIODevice::WriteOnly);
+    image.save(&buffer, "png");
+    return ret;
+}
+
+// Roads on a plain background, so that decoding costs about as much as a
+// real tile does.
+QByteArray tileData(const QColor &background)
+{
+    QImage image(256, 256, QImage::Format_RGB32);
+    image.fill(background);
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(QPen(Qt::white, 6));
+    for (int i = 0; i < 256; i += 64) {
+        painter.drawLine(i, 0, 256 - i, 256);
+        painter.drawLine(0, i + 16, 256, i + 40);
+    }
+    painter.setPen(QPen(Qt::darkGray, 1));
+    painter.drawRect(0, 0, 255, 255);
+    painter.end();
+    return toPng(image);
+}
+
+QByteArray iconData()
+{
+    QImage image(20, 32, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(Qt::red);
+    painter.drawEllipse(0, 0, 20, 20);
+    painter.drawPolygon(QPolygonF({ QPointF(3, 15), QPointF(17, 15), QPointF(10, 32) }));
+    painter.end();
+    return toPng(image);
+}
+
+}
+
+class TileStandIn::Private
+{
+public:
+    Private(TileStandIn *parent);
+
+    void respond(const QHttpServerRequest &request, QHttpServerResponder &&responder);
+
+    QHttpServer server;
+    int latency;
+    int maxAge;
+    int failureRate;
+    int port;
+    quint64 requests;
+    QByteArray tiles[2];
+    QByteArray icon;
+
+private:
+    TileStandIn *q;
+};
+
+TileStandIn::Private::Private(TileStandIn *parent)
+    : latency(0)
+    , maxAge(86400)
+    , failureRate(0)
+    , port(-1)
+    , requests(0)
+    , q(parent)
+{
+    tiles[0] = tileData(QColor(0xf2, 0xef, 0xe9));
+    tiles[1] = tileData(QColor(0xe5, 0xe3, 0xdf));
+    icon = iconData();
+    server.route("/", [this](const QHttpServerRequest &request, QHttpServerResponder &&responder) {
+        respond(request, std::move(responder));
+    });
+}
+
+void TileStandIn::Private::respond(const QHttpServerRequest &request, QHttpServerResponder &&responder)
+{
+    requests++;
+    const QUrlQuery query = request.query();
+    QByteArray data = icon;
+    QByteArray etag = QByteArrayLiteral("\"icon\"");
+    if (!query.hasQueryItem(QStringLiteral("icon"))) {
+        const int x = query.queryItemValue(QStringLiteral("x")).toInt();
+        const int y = query.queryItemValue(QStringLiteral("y")).toInt();
+        data = tiles[(x + y) & 1];
+        etag = (x + y) & 1 ? QByteArrayLiteral("\"tile1\"") : QByteArrayLiteral("\"tile0\"");
+    }
+    const bool failed = failureRate > 0 && static_cast<int>(QRandomGenerator::global()->bounded(100)) < failureRate;
+    const bool notModified = request.value(QStringLiteral("If-None-Match")).toLatin1() == etag;
+    const QByteArray cacheControl = QByteArrayLiteral("max-age=") + QByteArray::number(maxAge);
+
+    auto send = [data, etag, failed, notModified, cacheControl](QHttpServerResponder &responder) {
+        if (failed) {
+            responder.write(QHttpServerResponder::StatusCode::ServiceUnavailable);
+            return;
+        }
+        QHttpServerResponse response = notModified
+                ? QHttpServerResponse(QHttpServerResponder::StatusCode::NotModified)
+                : QHttpServerResponse(QByteArrayLiteral("image/png"), data);
+        response.addHeader(QByteArrayLiteral("ETag"), etag);
+        response.addHeader(QByteArrayLiteral("Cache-Control"), cacheControl);
+        responder.sendResponse(response);
+    };
+    if (latency <= 0) {
+        send(responder);
+        return;
+    }
+    QSharedPointer<QHttpServerResponder> pending(new QHttpServerResponder(std::move(responder)));
+    QTimer::singleShot(latency, q, [send, pending]() {
+        send(*pending);
+    });
+}
+
+TileStandIn::TileStandIn(QObject *parent)
+    : QObject(parent)
+    , d(new Private(this))
+{
+}
+
+TileStandIn::~TileStandIn()
+{
+    delete d;
+}
+
+int TileStandIn::latency() const
+{
+    return d->latency;
+}
+
+void TileStandIn::setLatency(int milliseconds)
+{
+    d->latency = std::max(0, milliseconds);
+}
+
+int TileStandIn::maxAge() const
+{
+    return d->maxAge;
+}
+
+void TileStandIn::setMaxAge(int seconds)
+{
+    d->maxAge = std::max(0, seconds);
+}
+
+int TileStandIn::failureRate() const
+{
+    return d->failureRate;
+}
+
+void TileStandIn::setFailureRate(int percent)
+{
+    d->failureRate = qBound(0, percent, 100);
+}
+
+int TileStandIn::listen(const QHostAddress &address, quint16 port)
+{
+    d->port = d->server.listen(address, port);
+    return d->port;
+}
+
+QString TileStandIn::tileUrl() const
+{
+    return QStringLiteral("http://127.0.0.1:%1/?z={z}&x={x}&y={y}").arg(d->port);
+}
+
+QString TileStandIn::iconUrl() const
+{
+    return QStringLiteral("http://127.0.0.1:%1/?icon=1").arg(d->port);
+}
+
+quint64 TileStandIn::requestCount() const
+{
+    return d->requests;
+}
@@ -0,0 +1,37 @@
+#ifndef TILESTANDIN_H
+#define TILESTANDIN_H
+
+#include <QtCore/QObject>
+#include <QtNetwork/QHostAddress>
+
+// A local tile server for benchmarks. Every tile is a generated 256x256 png
+// served after an artificial latency, so fetch costs are repeatable without
+// touching a real tile server. Tiles are addressed as ?z=&x=&y=, ?icon=1
+// returns a small marker icon. Responses carry an ETag and answer matching
+// conditional requests with 304; a share of them may fail with 503 to
+// exercise retries.
+class TileStandIn : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TileStandIn(QObject *parent = nullptr);
+    ~TileStandIn() override;
+
+    int latency() const;
+    void setLatency(int milliseconds);
+    int maxAge() const;
+    void setMaxAge(int seconds);
+    int failureRate() const;
+    void setFailureRate(int percent);
+
+    int listen(const QHostAddress &address = QHostAddress::LocalHost, quint16 port = 0);
+    QString tileUrl() const;
+    QString iconUrl() const;
+    quint64 requestCount() const;
+
+private:
+    class Private;
+    Private *d;
+};
+
+#endif // TILESTANDIN_H
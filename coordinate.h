@@ -1,37 +1,37 @@
 #ifndef COORDINATE_H
 #define COORDINATE_H
 
-#include <QtCore/QSharedDataPointer>
+#include <QtCore/QPointF>
+#include <QtCore/QString>
 
 class Coordinate
 {
 public:
-    Coordinate();
-    Coordinate(double latitude, double longitude);
-    Coordinate(const QString &latlng);
-    Coordinate(const Coordinate &other);
-    ~Coordinate();
-
-    Coordinate &operator=(const Coordinate &other);
-    void swap(Coordinate &other) Q_DECL_NOTHROW { qSwap(d, other.d); }
+    Q_DECL_CONSTEXPR Coordinate() : m_latitude(0.0), m_longitude(0.0) {}
+    Q_DECL_CONSTEXPR Coordinate(double latitude, double longitude) : m_latitude(latitude), m_longitude(longitude) {}
 
     bool operator==(const Coordinate &other) const;
+    bool operator!=(const Coordinate &other) const { return !operator==(other); }
 
-    double latitude() const;
-    void setLatitude(double latitude);
-    double longitude() const;
-    void setLongitude(double longitude);
+    double latitude() const { return m_latitude; }
+    void setLatitude(double latitude) { m_latitude = latitude; }
+    double longitude() const { return m_longitude; }
+    void setLongitude(double longitude) { m_longitude = longitude; }
 
     double x() const { return longitude(); }
     double y() const { return latitude(); }
 
+    // Projects count coordinates into points in one pass:
+    // x = (longitude - origin.longitude) * scaleX, y = (origin.latitude - latitude) * scaleY
+    static void project(const Coordinate *coordinates, int count, const Coordinate &origin, double scaleX, double scaleY, QPointF *points);
+
 private:
-    class Private;
-    QSharedDataPointer<Private> d;
+    double m_latitude;
+    double m_longitude;
 };
 
-Q_DECLARE_SHARED(Coordinate)
+Q_DECLARE_TYPEINFO(Coordinate, Q_PRIMITIVE_TYPE);
 
 QDebug operator<<(QDebug, const Coordinate &);
 
-#endif // COORDINATE_H
\ No newline at end of file
+#endif // COORDINATE_H
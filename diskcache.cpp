@@ -0,0 +1,718 @@
+#include "diskcache.h"
+#include "environment.h"
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QDirIterator>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
+#include <QtCore/QLockFile>
+#include <QtCore/QMutex>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSet>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+#include <QtCore/QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+struct Key {
+    quint64 hi;
+    quint64 lo;
+};
+
+inline bool operator==(const Key &a, const Key &b)
+{
+    return a.hi == b.hi && a.lo == b.lo;
+}
+
+inline uint qHash(const Key &key, uint seed = 0)
+{
+    return ::qHash(key.lo ^ key.hi, seed);
+}
+
+// Kept small on purpose: the index stays in memory for every cached file.
+// The metadata is in the file itself.
+struct Entry {
+    quint32 size;
+    quint32 accessed;
+};
+
+const quint32 indexMagic = 0x51534443; // "QSDC"
+const quint32 indexVersion = 2;
+
+// Every file starts with the metadata of the tile, so that it is there for
+// every process sharing the directory and survives a lost index:
+//   "QSDE", quint32 expires, lastModified, etag length, all little endian,
+//   the etag, then the data as it came from upstream
+const char entryMagic[4] = { 'Q', 'S', 'D', 'E' };
+const int entryHeaderSize = 16;
+
+// Journal records, little endian: quint64 key hi, lo, quint32 size, accessed.
+// A size of 0 records a removal.
+const int journalRecordSize = 24;
+
+quint32 now()
+{
+    return static_cast<quint32>(QDateTime::currentSecsSinceEpoch());
+}
+
+quint32 toSeconds(const QDateTime &dateTime)
+{
+    return dateTime.isValid() ? static_cast<quint32>(std::max<qint64>(0, dateTime.toSecsSinceEpoch())) : 0;
+}
+
+QDateTime fromSeconds(quint32 seconds)
+{
+    return seconds ? QDateTime::fromSecsSinceEpoch(seconds, Qt::UTC) : QDateTime();
+}
+
+QByteArray header(const DiskCache::Metadata &metadata)
+{
+    QByteArray ret(entryHeaderSize, Qt::Uninitialized);
+    uchar *data = reinterpret_cast<uchar *>(ret.data());
+    std::memcpy(data, entryMagic, sizeof(entryMagic));
+    qToLittleEndian<quint32>(toSeconds(metadata.expires), data + 4);
+    qToLittleEndian<quint32>(toSeconds(metadata.lastModified), data + 8);
+    qToLittleEndian<quint32>(static_cast<quint32>(metadata.etag.size()), data + 12);
+    return ret + metadata.etag;
+}
+
+// Leaves the file at the data.
+bool readHeader(QFile *file, DiskCache::Metadata *metadata)
+{
+    uchar data[entryHeaderSize];
+    if (file->read(reinterpret_cast<char *>(data), entryHeaderSize) != entryHeaderSize) return false;
+    if (std::memcmp(data, entryMagic, sizeof(entryMagic)) != 0) return false;
+    const quint32 etagLength = qFromLittleEndian<quint32>(data + 12);
+    if (etagLength > 1024) return false;
+    metadata->expires = fromSeconds(qFromLittleEndian<quint32>(data + 4));
+    metadata->lastModified = fromSeconds(qFromLittleEndian<quint32>(data + 8));
+    metadata->etag = file->read(etagLength);
+    return metadata->etag.size() == static_cast<int>(etagLength);
+}
+
+}
+
+class DiskCache::Private
+{
+public:
+    Private(const QString &path, qint64 maximumBytes);
+
+    static Key hash(const QByteArray &key);
+    QString filePath(const Key &key) const;
+
+    bool loadIndex();
+    void scan(int shard = -1);
+    bool claim();
+    void record(const Key &key, quint32 size) const;
+    void merge();
+    void maintain();
+    void saveIndex();
+    void evict();
+    void erase(QHash<Key, Entry>::iterator it);
+    void scheduleEviction();
+    bool touch(QFile *file) const;
+
+    QDir root;
+    qint64 maximumBytes;
+    int defaultTimeToLive;
+    int syncInterval;
+    qint64 bytes;
+    int dirty;
+    bool evictionScheduled;
+    // Other processes write to the directory too, see Prefork. The one
+    // holding the lock file keeps the index and evicts for all of them,
+    // the others look files up directly and journal what they change.
+    bool shared;
+    bool owner;
+    QLockFile *lockFile;
+    // the shard directory the owner rescans next
+    int shard;
+    QHash<Key, Entry> index;
+    mutable QMutex mutex;
+    // only one index write at a time, without holding the index
+    QMutex saving;
+    // evicts and writes the index from a thread of its own
+    QThread *thread;
+    QTimer *maintainer;
+
+    QAtomicInteger<quint64> hits;
+    QAtomicInteger<quint64> misses;
+    QAtomicInteger<quint64> evictions;
+};
+
+DiskCache::Private::Private(const QString &path, qint64 maximumBytes)
+    : root(path)
+    , maximumBytes(maximumBytes)
+    , defaultTimeToLive(environment("DISK_CACHE_TTL", 7 * 24 * 60 * 60))
+    , syncInterval(std::max(1, environment("DISK_CACHE_SYNC_INTERVAL", 30)))
+    , bytes(0)
+    , dirty(0)
+    , evictionScheduled(false)
+    , shared(qEnvironmentVariableIsSet("DISK_CACHE_SHARED"))
+    , owner(!shared)
+    , lockFile(nullptr)
+    , shard(0)
+    , thread(new QThread)
+    , maintainer(new QTimer)
+    , hits(0)
+    , misses(0)
+    , evictions(0)
+{
+    if (!root.exists()) {
+        root.mkpath(".");
+    }
+    // Lookups go by the index, so without one it is rebuilt before the
+    // first. A loaded one is used right away and brought in line with the
+    // directory in the background; lookups in a shared directory go by the
+    // files anyway.
+    bool reconcile = false;
+    if (shared) {
+        lockFile = new QLockFile(root.filePath(QStringLiteral("owner")));
+        // only a holder that is gone gives the lock up
+        lockFile->setStaleLockTime(0);
+        owner = lockFile->tryLock(0);
+        reconcile = owner;
+        if (owner) {
+            loadIndex();
+        }
+    } else if (loadIndex()) {
+        reconcile = true;
+    } else {
+        scan();
+        evict();
+    }
+
+    thread->setObjectName(QStringLiteral("diskcache"));
+    maintainer->setInterval(syncInterval * 1000);
+    maintainer->moveToThread(thread);
+    QObject::connect(maintainer, &QTimer::timeout, maintainer, [this]() { maintain(); });
+    QObject::connect(thread, &QThread::started, maintainer, QOverload<>::of(&QTimer::start));
+    if (reconcile) {
+        QMetaObject::invokeMethod(maintainer, [this]() {
+            scan();
+            evict();
+            saveIndex();
+        }, Qt::QueuedConnection);
+    }
+    thread->start();
+}
+
+Key DiskCache::Private::hash(const QByteArray &key)
+{
+    const QByteArray digest = QCryptographicHash::hash(key, QCryptographicHash::Sha1);
+    Key ret;
+    ret.hi = qFromBigEndian<quint64>(digest.constData());
+    ret.lo = qFromBigEndian<quint64>(digest.constData() + 8);
+    return ret;
+}
+
+QString DiskCache::Private::filePath(const Key &key) const
+{
+    const QString name = QStringLiteral("%1%2").arg(key.hi, 16, 16, QLatin1Char('0')).arg(key.lo, 16, 16, QLatin1Char('0'));
+    return root.filePath(name.left(2) + QLatin1Char('/') + name.mid(2, 2) + QLatin1Char('/') + name);
+}
+
+bool DiskCache::Private::loadIndex()
+{
+    QFile file(root.filePath(QStringLiteral("index")));
+    if (!file.open(QFile::ReadOnly)) return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    quint32 magic, version, count;
+    stream >> magic >> version >> count;
+    if (magic != indexMagic || version != indexVersion) return false;
+
+    // read aside, lookups go on meanwhile when the index is taken over
+    QHash<Key, Entry> loaded;
+    qint64 loadedBytes = 0;
+    loaded.reserve(static_cast<int>(count));
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+        Key key;
+        Entry entry;
+        stream >> key.hi >> key.lo >> entry.size >> entry.accessed;
+        loaded.insert(key, entry);
+        loadedBytes += entry.size;
+    }
+    if (stream.status() != QDataStream::Ok) {
+        qWarning() << "disk cache index is corrupt, rebuilding" << file.fileName();
+        return false;
+    }
+    QMutexLocker locker(&mutex);
+    index.swap(loaded);
+    bytes = loadedBytes;
+    return true;
+}
+
+// Brings the index in line with the directory: files written since the
+// index was last saved, or by other processes, are added, entries whose
+// file is gone are dropped. Files touched by other processes move up in
+// the LRU order. The directory is walked without holding the index;
+// entries inserted or used meanwhile are kept. A shard, the first byte of
+// the key, limits the walk to one of the top level directories.
+void DiskCache::Private::scan(int shard)
+{
+    const quint32 started = now();
+    struct File {
+        Key key;
+        quint32 size;
+        quint32 modified;
+    };
+    QVector<File> files;
+    const QString directory = shard < 0 ? root.path() : root.filePath(QStringLiteral("%1").arg(shard, 2, 16, QLatin1Char('0')));
+    QDirIterator it(directory, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        const QString name = it.fileName();
+        if (name.length() != 32) {
+            // leftovers of interrupted atomic writes, unless another
+            // process may be in the middle of one
+            if (name.length() > 32 && !shared) QFile::remove(it.filePath());
+            continue;
+        }
+        bool ok1, ok2;
+        File file;
+        file.key.hi = name.leftRef(16).toULongLong(&ok1, 16);
+        file.key.lo = name.midRef(16).toULongLong(&ok2, 16);
+        if (!ok1 || !ok2) continue;
+        const QFileInfo info = it.fileInfo();
+        file.size = static_cast<quint32>(info.size());
+        file.modified = toSeconds(info.lastModified());
+        files.append(file);
+    }
+
+    QMutexLocker locker(&mutex);
+    QSet<Key> found;
+    found.reserve(files.size());
+    for (const File &file : qAsConst(files)) {
+        found.insert(file.key);
+        Entry &entry = index[file.key];
+        if (entry.size == 0) {
+            entry.accessed = file.modified;
+            dirty++;
+        } else {
+            entry.accessed = std::max(entry.accessed, file.modified);
+        }
+        bytes += static_cast<qint64>(file.size) - entry.size;
+        entry.size = file.size;
+    }
+    for (auto it = index.begin(); it != index.end();) {
+        if (found.contains(it.key()) || it.value().accessed >= started
+                || (shard >= 0 && static_cast<int>(it.key().hi >> 56) != shard)) {
+            ++it;
+        } else {
+            bytes -= it.value().size;
+            it = index.erase(it);
+            dirty++;
+        }
+    }
+}
+
+// A process sharing the directory takes over the index and eviction when
+// the one holding the lock file has gone: it loads the index the previous
+// owner saved and reconciles it with the directory once.
+bool DiskCache::Private::claim()
+{
+    {
+        QMutexLocker locker(&mutex);
+        if (owner) return true;
+    }
+    if (!lockFile->tryLock(0)) return false;
+    loadIndex();
+    {
+        QMutexLocker locker(&mutex);
+        owner = true;
+    }
+    scan();
+    return true;
+}
+
+// Appended with a single write, so that records of several processes do
+// not interleave.
+void DiskCache::Private::record(const Key &key, quint32 size) const
+{
+    uchar data[journalRecordSize];
+    qToLittleEndian<quint64>(key.hi, data);
+    qToLittleEndian<quint64>(key.lo, data + 8);
+    qToLittleEndian<quint32>(size, data + 16);
+    qToLittleEndian<quint32>(now(), data + 20);
+    QFile file(root.filePath(QStringLiteral("journal")));
+    if (file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered)) {
+        file.write(reinterpret_cast<const char *>(data), sizeof(data));
+    }
+}
+
+// The journal is taken over by renaming it; the few records appended to it
+// in between are picked up by the shard scans. A removal is dropped when
+// the entry was written or used after it.
+void DiskCache::Private::merge()
+{
+    const QString merging = root.filePath(QStringLiteral("journal.merging"));
+    if (!QFile::exists(merging) && !QFile::rename(root.filePath(QStringLiteral("journal")), merging)) return;
+    QFile file(merging);
+    if (!file.open(QFile::ReadOnly)) return;
+    const QByteArray journal = file.readAll();
+    file.remove();
+
+    QMutexLocker locker(&mutex);
+    const uchar *data = reinterpret_cast<const uchar *>(journal.constData());
+    for (int offset = 0; offset + journalRecordSize <= journal.size(); offset += journalRecordSize) {
+        Key key;
+        key.hi = qFromLittleEndian<quint64>(data + offset);
+        key.lo = qFromLittleEndian<quint64>(data + offset + 8);
+        const quint32 size = qFromLittleEndian<quint32>(data + offset + 16);
+        const quint32 accessed = qFromLittleEndian<quint32>(data + offset + 20);
+        auto it = index.find(key);
+        if (size == 0) {
+            if (it != index.end() && it.value().accessed <= accessed) {
+                erase(it);
+            }
+            continue;
+        }
+        if (it == index.end()) {
+            it = index.insert(key, Entry { 0, 0 });
+        }
+        bytes += static_cast<qint64>(size) - it.value().size;
+        it.value().size = size;
+        it.value().accessed = std::max(it.value().accessed, accessed);
+        dirty++;
+    }
+}
+
+// In a shared directory the owner merges the journal and rescans one shard
+// per interval, which catches what the journal missed within 256 of them.
+void DiskCache::Private::maintain()
+{
+    if (shared) {
+        if (!claim()) return;
+        merge();
+        scan(shard);
+        shard = (shard + 1) % 256;
+    }
+    evict();
+    saveIndex();
+}
+
+// Written from a copy, so that lookups and inserts go on meanwhile. In a
+// shared directory only the owner has an index to write.
+void DiskCache::Private::saveIndex()
+{
+    QMutexLocker saver(&saving);
+    QVector<QPair<Key, Entry>> entries;
+    {
+        QMutexLocker locker(&mutex);
+        if (!owner || dirty == 0) return;
+        dirty = 0;
+        entries.reserve(index.size());
+        for (auto it = index.constBegin(); it != index.constEnd(); ++it) {
+            entries.append(qMakePair(it.key(), it.value()));
+        }
+    }
+
+    QSaveFile file(root.filePath(QStringLiteral("index")));
+    if (file.open(QIODevice::WriteOnly)) {
+        QDataStream stream(&file);
+        stream.setVersion(QDataStream::Qt_5_6);
+        stream << indexMagic << indexVersion << static_cast<quint32>(entries.size());
+        for (const auto &item : qAsConst(entries)) {
+            stream << item.first.hi << item.first.lo << item.second.size << item.second.accessed;
+        }
+        if (file.commit()) return;
+    }
+    QMutexLocker locker(&mutex);
+    dirty++;
+}
+
+// Evicts least recently used files down to 90% of the budget, so that the
+// sort is amortized over many inserts. The order is worked out on a copy
+// of the access times; files used since are left alone.
+void DiskCache::Private::evict()
+{
+    struct Candidate {
+        quint32 accessed;
+        Key key;
+    };
+    QVector<Candidate> order;
+    qint64 excess;
+    {
+        QMutexLocker locker(&mutex);
+        evictionScheduled = false;
+        if (!owner || bytes <= maximumBytes) return;
+        excess = bytes - maximumBytes / 10 * 9;
+        order.reserve(index.size());
+        for (auto it = index.constBegin(); it != index.constEnd(); ++it) {
+            order.append({ it.value().accessed, it.key() });
+        }
+    }
+    std::sort(order.begin(), order.end(), [](const Candidate &a, const Candidate &b) {
+        return a.accessed < b.accessed;
+    });
+
+    QVector<Key> victims;
+    {
+        QMutexLocker locker(&mutex);
+        for (const Candidate &candidate : qAsConst(order)) {
+            if (excess <= 0) break;
+            auto it = index.find(candidate.key);
+            if (it == index.end() || it.value().accessed != candidate.accessed) continue;
+            excess -= it.value().size;
+            erase(it);
+            victims.append(candidate.key);
+        }
+    }
+    for (const Key &key : qAsConst(victims)) {
+        QFile::remove(filePath(key));
+    }
+    evictions.fetchAndAddRelaxed(static_cast<quint64>(victims.size()));
+}
+
+void DiskCache::Private::erase(QHash<Key, Entry>::iterator it)
+{
+    bytes -= it.value().size;
+    index.erase(it);
+    dirty++;
+}
+
+// called with the mutex held
+void DiskCache::Private::scheduleEviction()
+{
+    if (bytes <= maximumBytes || evictionScheduled) return;
+    evictionScheduled = true;
+    QMetaObject::invokeMethod(maintainer, [this]() { evict(); }, Qt::QueuedConnection);
+}
+
+// In a shared directory the modification time tells the owner which files
+// the others use; it is moved, and the use journaled, at most once per sync
+// interval.
+bool DiskCache::Private::touch(QFile *file) const
+{
+    const QDateTime current = QDateTime::currentDateTimeUtc();
+    if (file->fileTime(QFileDevice::FileModificationTime).secsTo(current) <= syncInterval) return false;
+    return file->setFileTime(current, QFileDevice::FileModificationTime);
+}
+
+DiskCache::DiskCache(const QString &path, qint64 maximumBytes)
+    : d(new Private(path, maximumBytes))
+{
+}
+
+DiskCache::~DiskCache()
+{
+    d->thread->quit();
+    d->thread->wait();
+    delete d->maintainer;
+    delete d->thread;
+    sync();
+    delete d->lockFile;
+    delete d;
+}
+
+DiskCache *DiskCache::instance()
+{
+    static DiskCache cache(qEnvironmentVariableIsSet("DISK_CACHE_PATH")
+                           ? qEnvironmentVariable("DISK_CACHE_PATH")
+                           : QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/tiles"),
+                           environment("DISK_CACHE_SIZE", 1024) * Q_INT64_C(1024) * 1024);
+    return &cache;
+}
+
+// Files without a valid header, written by an older version, are removed.
+QByteArray DiskCache::find(const QByteArray &key, Metadata *metadata, bool *expired)
+{
+    const Key k = Private::hash(key);
+    bool owner;
+    {
+        QMutexLocker locker(&d->mutex);
+        owner = d->owner;
+        auto it = d->index.find(k);
+        if (it != d->index.end()) {
+            Entry &entry = it.value();
+            const quint32 accessed = now();
+            if (entry.accessed != accessed) {
+                entry.accessed = accessed;
+                d->dirty++;
+            }
+        } else if (!d->shared) {
+            d->misses.fetchAndAddRelaxed(1);
+            return QByteArray();
+        }
+    }
+
+    QFile file(d->filePath(k));
+    Metadata stored;
+    if (!file.open(QFile::ReadOnly) || !readHeader(&file, &stored)) {
+        if (file.isOpen()) {
+            file.remove();
+            if (!owner) d->record(k, 0);
+        }
+        QMutexLocker locker(&d->mutex);
+        auto it = d->index.find(k);
+        if (it != d->index.end()) {
+            d->erase(it);
+        }
+        d->misses.fetchAndAddRelaxed(1);
+        return QByteArray();
+    }
+    if (d->shared && d->touch(&file) && !owner) {
+        d->record(k, static_cast<quint32>(file.size()));
+    }
+    if (metadata) {
+        *metadata = stored;
+    }
+    if (expired) {
+        *expired = toSeconds(stored.expires) < now();
+    }
+    d->hits.fetchAndAddRelaxed(1);
+    return file.readAll();
+}
+
+bool DiskCache::contains(const QByteArray &key, bool *expired) const
+{
+    const Key k = Private::hash(key);
+    if (!d->shared) {
+        QMutexLocker locker(&d->mutex);
+        if (!d->index.contains(k)) return false;
+    }
+    QFile file(d->filePath(k));
+    Metadata metadata;
+    if (!file.open(QFile::ReadOnly) || !readHeader(&file, &metadata)) return false;
+    if (expired) {
+        *expired = toSeconds(metadata.expires) < now();
+    }
+    return true;
+}
+
+bool DiskCache::insert(const QByteArray &key, const QByteArray &data, const Metadata &metadata)
+{
+    if (data.isEmpty()) return false;
+
+    const Key k = Private::hash(key);
+    const QString fileName = d->filePath(k);
+    d->root.mkpath(QFileInfo(fileName).path());
+
+    const QByteArray head = header(metadata);
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    file.write(head);
+    file.write(data);
+    if (!file.commit()) return false;
+
+    const quint32 size = static_cast<quint32>(head.size() + data.size());
+    QMutexLocker locker(&d->mutex);
+    if (!d->owner) {
+        locker.unlock();
+        d->record(k, size);
+        return true;
+    }
+    Entry &entry = d->index[k];
+    d->bytes += static_cast<qint64>(size) - entry.size;
+    entry.size = size;
+    entry.accessed = now();
+    d->dirty++;
+    d->scheduleEviction();
+    return true;
+}
+
+// The data is written again behind the new header.
+void DiskCache::updateMetadata(const QByteArray &key, const Metadata &metadata)
+{
+    const Key k = Private::hash(key);
+    const QString fileName = d->filePath(k);
+    QFile file(fileName);
+    Metadata stored;
+    if (!file.open(QFile::ReadOnly) || !readHeader(&file, &stored)) return;
+    const QByteArray data = file.readAll();
+    file.close();
+
+    const QByteArray head = header(metadata);
+    QSaveFile updated(fileName);
+    if (!updated.open(QIODevice::WriteOnly)) return;
+    updated.write(head);
+    updated.write(data);
+    if (!updated.commit()) return;
+
+    const quint32 size = static_cast<quint32>(head.size() + data.size());
+    QMutexLocker locker(&d->mutex);
+    if (!d->owner) {
+        locker.unlock();
+        d->record(k, size);
+        return;
+    }
+    auto it = d->index.find(k);
+    if (it == d->index.end()) return;
+    d->bytes += static_cast<qint64>(size) - it.value().size;
+    it.value().size = size;
+    d->dirty++;
+}
+
+void DiskCache::remove(const QByteArray &key)
+{
+    const Key k = Private::hash(key);
+    QMutexLocker locker(&d->mutex);
+    QFile::remove(d->filePath(k));
+    if (!d->owner) {
+        locker.unlock();
+        d->record(k, 0);
+        return;
+    }
+    auto it = d->index.find(k);
+    if (it == d->index.end()) return;
+    d->erase(it);
+}
+
+void DiskCache::clear()
+{
+    QMutexLocker locker(&d->mutex);
+    for (auto it = d->index.constBegin(); it != d->index.constEnd(); ++it) {
+        QFile::remove(d->filePath(it.key()));
+    }
+    d->index.clear();
+    d->bytes = 0;
+    d->dirty++;
+    locker.unlock();
+    d->saveIndex();
+}
+
+void DiskCache::sync()
+{
+    d->saveIndex();
+}
+
+QString DiskCache::path() const
+{
+    return d->root.path();
+}
+
+qint64 DiskCache::maximumBytes() const
+{
+    return d->maximumBytes;
+}
+
+int DiskCache::defaultTimeToLive() const
+{
+    return d->defaultTimeToLive;
+}
+
+// only the owner of a shared directory counts its files
+DiskCache::Statistics DiskCache::statistics() const
+{
+    Statistics ret;
+    ret.hits = d->hits.loadAcquire();
+    ret.misses = d->misses.loadAcquire();
+    ret.evictions = d->evictions.loadAcquire();
+    QMutexLocker locker(&d->mutex);
+    ret.bytes = d->bytes;
+    ret.count = d->index.size();
+    return ret;
+}
@@ -0,0 +1,48 @@
+#ifndef DISKCACHE_H
+#define DISKCACHE_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDateTime>
+#include <QtCore/QString>
+
+class DiskCache
+{
+public:
+    struct Metadata {
+        QDateTime expires;
+        QDateTime lastModified;
+        QByteArray etag;
+    };
+    struct Statistics {
+        quint64 hits;
+        quint64 misses;
+        quint64 evictions;
+        qint64 bytes;
+        int count;
+    };
+
+    DiskCache(const QString &path, qint64 maximumBytes);
+    ~DiskCache();
+
+    static DiskCache *instance();
+
+    QByteArray find(const QByteArray &key, Metadata *metadata = nullptr, bool *expired = nullptr);
+    bool contains(const QByteArray &key, bool *expired = nullptr) const;
+    bool insert(const QByteArray &key, const QByteArray &data, const Metadata &metadata);
+    void updateMetadata(const QByteArray &key, const Metadata &metadata);
+    void remove(const QByteArray &key);
+    void clear();
+    void sync();
+
+    QString path() const;
+    qint64 maximumBytes() const;
+    int defaultTimeToLive() const;
+    Statistics statistics() const;
+
+private:
+    Q_DISABLE_COPY(DiskCache)
+    class Private;
+    Private *d;
+};
+
+#endif // DISKCACHE_H
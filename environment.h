@@ -0,0 +1,16 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <QtCore/QtGlobal>
+
+// The integer in an environment variable, or defaultValue when it is not
+// set or not a number. Zero and negative values are returned as they are;
+// callers that cannot take them bound the result.
+inline int environment(const char *name, int defaultValue)
+{
+    bool ok = false;
+    const int ret = qEnvironmentVariableIntValue(name, &ok);
+    return ok ? ret : defaultValue;
+}
+
+#endif // ENVIRONMENT_H
@@ -0,0 +1,149 @@
+#include "imagecache.h"
+#include "environment.h"
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QCache>
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
+
+#include <algorithm>
+#include <limits>
+
+// Each shard is an LRU QCache guarded by its own mutex; costs are kept in KiB
+// so that a shard can hold more than 2 GiB worth of decoded pixels.
+class ImageCache::Private
+{
+public:
+    struct Shard {
+        QMutex mutex;
+        QCache<QByteArray, QImage> cache;
+    };
+
+    Private(qint64 maximumBytes, int shards);
+    ~Private();
+
+    Shard *shard(const QByteArray &key) const;
+    static int cost(const QImage &image);
+
+    qint64 maximumBytes;
+    QVector<Shard *> shards;
+    mutable QAtomicInteger<quint64> hits;
+    mutable QAtomicInteger<quint64> misses;
+    QAtomicInteger<quint64> evictions;
+};
+
+ImageCache::Private::Private(qint64 maximumBytes, int shards)
+    : maximumBytes(maximumBytes)
+    , hits(0)
+    , misses(0)
+    , evictions(0)
+{
+    shards = std::max(1, shards);
+    int maximumCost = static_cast<int>(std::min<qint64>(maximumBytes / 1024 / shards, std::numeric_limits<int>::max()));
+    for (int i = 0; i < shards; i++) {
+        Shard *shard = new Shard;
+        shard->cache.setMaxCost(maximumCost);
+        this->shards.append(shard);
+    }
+}
+
+ImageCache::Private::~Private()
+{
+    qDeleteAll(shards);
+}
+
+ImageCache::Private::Shard *ImageCache::Private::shard(const QByteArray &key) const
+{
+    return shards.at(qHash(key) % static_cast<uint>(shards.size()));
+}
+
+int ImageCache::Private::cost(const QImage &image)
+{
+    return static_cast<int>(std::max<qint64>(1, image.sizeInBytes() / 1024));
+}
+
+ImageCache::ImageCache(qint64 maximumBytes, int shards)
+    : d(new Private(maximumBytes, shards))
+{
+}
+
+ImageCache::~ImageCache()
+{
+    delete d;
+}
+
+ImageCache *ImageCache::instance()
+{
+    static ImageCache cache(environment("IMAGE_CACHE_SIZE", 256) * Q_INT64_C(1024) * 1024);
+    return &cache;
+}
+
+QImage ImageCache::find(const QByteArray &key) const
+{
+    Private::Shard *shard = d->shard(key);
+    QMutexLocker locker(&shard->mutex);
+    QImage *image = shard->cache.object(key);
+    if (!image) {
+        d->misses.fetchAndAddRelaxed(1);
+        return QImage();
+    }
+    d->hits.fetchAndAddRelaxed(1);
+    return *image;
+}
+
+bool ImageCache::contains(const QByteArray &key) const
+{
+    Private::Shard *shard = d->shard(key);
+    QMutexLocker locker(&shard->mutex);
+    return shard->cache.contains(key);
+}
+
+void ImageCache::insert(const QByteArray &key, const QImage &image)
+{
+    if (image.isNull()) return;
+
+    Private::Shard *shard = d->shard(key);
+    QMutexLocker locker(&shard->mutex);
+    int before = shard->cache.count() + (shard->cache.contains(key) ? 0 : 1);
+    shard->cache.insert(key, new QImage(image), Private::cost(image));
+    int evicted = before - shard->cache.count();
+    if (evicted > 0) {
+        d->evictions.fetchAndAddRelaxed(static_cast<quint64>(evicted));
+    }
+}
+
+void ImageCache::remove(const QByteArray &key)
+{
+    Private::Shard *shard = d->shard(key);
+    QMutexLocker locker(&shard->mutex);
+    shard->cache.remove(key);
+}
+
+void ImageCache::clear()
+{
+    for (Private::Shard *shard : d->shards) {
+        QMutexLocker locker(&shard->mutex);
+        shard->cache.clear();
+    }
+}
+
+qint64 ImageCache::maximumBytes() const
+{
+    return d->maximumBytes;
+}
+
+ImageCache::Statistics ImageCache::statistics() const
+{
+    Statistics ret;
+    ret.hits = d->hits.loadAcquire();
+    ret.misses = d->misses.loadAcquire();
+    ret.evictions = d->evictions.loadAcquire();
+    ret.bytes = 0;
+    ret.count = 0;
+    for (Private::Shard *shard : d->shards) {
+        QMutexLocker locker(&shard->mutex);
+        ret.bytes += shard->cache.totalCost() * Q_INT64_C(1024);
+        ret.count += shard->cache.count();
+    }
+    return ret;
+}
@@ -0,0 +1,38 @@
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <QtCore/QByteArray>
+#include <QtGui/QImage>
+
+class ImageCache
+{
+public:
+    struct Statistics {
+        quint64 hits;
+        quint64 misses;
+        quint64 evictions;
+        qint64 bytes;
+        int count;
+    };
+
+    explicit ImageCache(qint64 maximumBytes, int shards = 16);
+    ~ImageCache();
+
+    static ImageCache *instance();
+
+    QImage find(const QByteArray &key) const;
+    bool contains(const QByteArray &key) const;
+    void insert(const QByteArray &key, const QImage &image);
+    void remove(const QByteArray &key);
+    void clear();
+
+    qint64 maximumBytes() const;
+    Statistics statistics() const;
+
+private:
+    Q_DISABLE_COPY(ImageCache)
+    class Private;
+    Private *d;
+};
+
+#endif // IMAGECACHE_H
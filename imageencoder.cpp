@@ -0,0 +1,241 @@
+#include "imageencoder.h"
+
+#include <QtCore/QBuffer>
+#include <QtCore/QDebug>
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+
+#include <QtGui/QImageWriter>
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+const char *writerFormat(ImageEncoder::Format format)
+{
+    switch (format) {
+    case ImageEncoder::Png:
+    case ImageEncoder::Png8:
+        return "png";
+    case ImageEncoder::Jpeg:
+        return "jpeg";
+    case ImageEncoder::WebP:
+        return "webp";
+    }
+    return "png";
+}
+
+int defaultQuality(ImageEncoder::Format format)
+{
+    switch (format) {
+    case ImageEncoder::Png:
+    case ImageEncoder::Png8:
+        return 80;
+    case ImageEncoder::Jpeg:
+        return 85;
+    case ImageEncoder::WebP:
+        return 80;
+    }
+    return -1;
+}
+
+inline int bin(QRgb rgb)
+{
+    return ((rgb >> 9) & 0x7c00) | ((rgb >> 6) & 0x3e0) | ((rgb >> 3) & 0x1f);
+}
+
+}
+
+ImageEncoder::ImageEncoder()
+    : m_format(Png)
+    , m_quality(-1)
+{
+}
+
+ImageEncoder::Format ImageEncoder::format() const
+{
+    return m_format;
+}
+
+void ImageEncoder::setFormat(Format format)
+{
+    m_format = format;
+}
+
+bool ImageEncoder::setFormat(const QString &name)
+{
+    static const QHash<QString, Format> formats = {
+        { QStringLiteral("png"), Png },
+        { QStringLiteral("png8"), Png8 },
+        { QStringLiteral("jpg"), Jpeg },
+        { QStringLiteral("jpeg"), Jpeg },
+        { QStringLiteral("webp"), WebP },
+    };
+    auto it = formats.constFind(name.toLower());
+    if (it == formats.constEnd() || !isSupported(it.value())) return false;
+    m_format = it.value();
+    return true;
+}
+
+int ImageEncoder::quality() const
+{
+    return m_quality;
+}
+
+void ImageEncoder::setQuality(int quality)
+{
+    m_quality = std::min(quality, 100);
+}
+
+QByteArray ImageEncoder::mimeType() const
+{
+    switch (m_format) {
+    case Png:
+    case Png8:
+        return QByteArrayLiteral("image/png");
+    case Jpeg:
+        return QByteArrayLiteral("image/jpeg");
+    case WebP:
+        return QByteArrayLiteral("image/webp");
+    }
+    return QByteArray();
+}
+
+bool ImageEncoder::encode(const QImage &image, QByteArray *data) const
+{
+    // rendered maps are opaque, dropping alpha keeps the writers on their RGB paths
+    const QImage source = m_format == Png8 ? quantize(image) : image.convertToFormat(QImage::Format_RGB32);
+
+    // Room for about what a rendered map compresses to, so that the writer
+    // rarely has to grow the array; what is left over is given back, the
+    // result is kept in the response cache by its size.
+    QByteArray ret;
+    ret.reserve(static_cast<int>(std::min<qint64>(source.sizeInBytes() / (m_format == Png || m_format == Png8 ? 8 : 16), std::numeric_limits<int>::max())));
+    QBuffer device(&ret);
+    device.open(QIODevice::WriteOnly);
+    QImageWriter writer(&device, writerFormat(m_format));
+    writer.setQuality(m_quality < 0 ? defaultQuality(m_format) : m_quality);
+    if (!writer.write(source)) {
+        qWarning() << writer.errorString();
+        return false;
+    }
+    device.close();
+    ret.squeeze();
+    *data = ret;
+    return true;
+}
+
+bool ImageEncoder::isSupported(Format format)
+{
+    static const QList<QByteArray> formats = QImageWriter::supportedImageFormats();
+    return formats.contains(writerFormat(format));
+}
+
+// Fast 8-bit quantization. Images with at most 256 colors, which is common
+// for map tiles, get an exact palette. Otherwise the 256 most populated bins
+// of a 15-bit RGB histogram become the palette.
+QImage ImageEncoder::quantize(const QImage &image)
+{
+    const QImage source = image.convertToFormat(QImage::Format_RGB32);
+    const int width = source.width();
+    const int height = source.height();
+    QImage ret(width, height, QImage::Format_Indexed8);
+    if (ret.isNull()) return ret;
+
+    QHash<QRgb, int> exact;
+    bool fits = true;
+    for (int y = 0; y < height && fits; y++) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(source.constScanLine(y));
+        uchar *out = ret.scanLine(y);
+        QRgb previous = ~line[0];
+        int index = 0;
+        for (int x = 0; x < width; x++) {
+            if (line[x] != previous) {
+                previous = line[x];
+                auto it = exact.constFind(previous);
+                if (it != exact.constEnd()) {
+                    index = it.value();
+                } else if (exact.size() < 256) {
+                    index = exact.size();
+                    exact.insert(previous, index);
+                } else {
+                    fits = false;
+                    break;
+                }
+            }
+            out[x] = static_cast<uchar>(index);
+        }
+    }
+    if (fits) {
+        QVector<QRgb> palette(exact.size());
+        for (auto it = exact.constBegin(); it != exact.constEnd(); ++it) {
+            palette[it.value()] = it.key();
+        }
+        ret.setColorTable(palette);
+        return ret;
+    }
+
+    struct Bin {
+        quint32 count;
+        quint32 red;
+        quint32 green;
+        quint32 blue;
+    };
+    QVector<Bin> bins(32768);
+    for (int y = 0; y < height; y++) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(source.constScanLine(y));
+        for (int x = 0; x < width; x++) {
+            Bin &b = bins[bin(line[x])];
+            b.count++;
+            b.red += qRed(line[x]);
+            b.green += qGreen(line[x]);
+            b.blue += qBlue(line[x]);
+        }
+    }
+
+    QVector<int> used;
+    for (int i = 0; i < bins.size(); i++) {
+        if (bins.at(i).count) used.append(i);
+    }
+    std::sort(used.begin(), used.end(), [&bins](int a, int b) {
+        return bins.at(a).count > bins.at(b).count;
+    });
+
+    auto mean = [&bins](int i) {
+        const Bin &b = bins.at(i);
+        return qRgb(b.red / b.count, b.green / b.count, b.blue / b.count);
+    };
+    QVector<QRgb> palette;
+    for (int i = 0; i < std::min(256, used.size()); i++) {
+        palette.append(mean(used.at(i)));
+    }
+
+    QVector<uchar> lut(32768);
+    for (int i : used) {
+        const QRgb color = mean(i);
+        int best = 0;
+        int distance = std::numeric_limits<int>::max();
+        for (int j = 0; j < palette.size() && distance > 0; j++) {
+            int dr = qRed(color) - qRed(palette.at(j));
+            int dg = qGreen(color) - qGreen(palette.at(j));
+            int db = qBlue(color) - qBlue(palette.at(j));
+            int d = dr * dr + dg * dg + db * db;
+            if (d < distance) {
+                distance = d;
+                best = j;
+            }
+        }
+        lut[i] = static_cast<uchar>(best);
+    }
+
+    for (int y = 0; y < height; y++) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(source.constScanLine(y));
+        uchar *out = ret.scanLine(y);
+        for (int x = 0; x < width; x++) {
+            out[x] = lut.at(bin(line[x]));
+        }
+    }
+    ret.setColorTable(palette);
+    return ret;
+}
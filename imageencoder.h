@@ -0,0 +1,41 @@
+#ifndef IMAGEENCODER_H
+#define IMAGEENCODER_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtGui/QImage>
+
+class ImageEncoder
+{
+public:
+    enum Format {
+        Png,
+        Png8,
+        Jpeg,
+        WebP,
+    };
+
+    ImageEncoder();
+
+    Format format() const;
+    void setFormat(Format format);
+    bool setFormat(const QString &name);
+
+    // 0-100, -1 picks the default of the format. For PNG it selects the
+    // zlib compression level, higher quality means faster, larger output.
+    int quality() const;
+    void setQuality(int quality);
+
+    QByteArray mimeType() const;
+    // returns false, leaving data alone, if the writer fails
+    bool encode(const QImage &image, QByteArray *data) const;
+
+    static bool isSupported(Format format);
+    static QImage quantize(const QImage &image);
+
+private:
+    Format m_format;
+    int m_quality;
+};
+
+#endif // IMAGEENCODER_H
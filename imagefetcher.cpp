@@ -0,0 +1,709 @@
+#include "imagefetcher.h"
+#include "environment.h"
+#include "imagecache.h"
+#include "diskcache.h"
+#include "sharedtilecache.h"
+#include "tilesource.h"
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QEventLoop>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
+#include <QtCore/QLocale>
+#include <QtCore/QMutex>
+#include <QtCore/QQueue>
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QSet>
+#include <QtCore/QThread>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QTimer>
+
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkRequest>
+#include <QtNetwork/QNetworkReply>
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+namespace {
+
+int timeout()
+{
+    static const int ret = environment("UPSTREAM_TIMEOUT_MS", 10000);
+    return ret;
+}
+
+int maximumRetries()
+{
+    static const int ret = environment("UPSTREAM_RETRIES", 2);
+    return ret;
+}
+
+// larger images are refused, wherever they come from
+qint64 maximumSize()
+{
+    static const qint64 ret = static_cast<qint64>(environment("MAX_IMAGE_SIZE", 8 * 1024)) * 1024;
+    return ret;
+}
+
+// how long past its expiry a tile is still served while it is refreshed
+int maximumStale()
+{
+    static const int ret = environment("UPSTREAM_MAX_STALE", 7 * 24 * 60 * 60);
+    return ret;
+}
+
+// lets the other worker processes use the tile, see Prefork
+void share(const QByteArray &key, const QByteArray &data, const DiskCache::Metadata &metadata)
+{
+    if (SharedTileCache *shared = SharedTileCache::instance()) {
+        shared->insert(key, data, metadata.expires);
+    }
+}
+
+// Exponential backoff with full jitter, so that retries of tiles that failed
+// together do not hit the upstream together again.
+int retryDelay(int attempt)
+{
+    static const int base = environment("UPSTREAM_RETRY_DELAY_MS", 200);
+    const int ceiling = static_cast<int>(std::min<qint64>(static_cast<qint64>(base) << std::min(attempt, 16), 30000));
+    return static_cast<int>(QRandomGenerator::global()->bounded(ceiling / 2, std::max(ceiling / 2 + 1, ceiling)));
+}
+
+// Failed urls are not asked for again for NEGATIVE_CACHE_TTL seconds, twice
+// as long after every further failure up to NEGATIVE_CACHE_MAX_TTL.
+int negativeTimeToLive(int failures)
+{
+    static const int base = environment("NEGATIVE_CACHE_TTL", 30);
+    static const int maximum = environment("NEGATIVE_CACHE_MAX_TTL", 3600);
+    return static_cast<int>(std::min<qint64>(static_cast<qint64>(std::max(0, base)) << std::min(failures - 1, 20), maximum));
+}
+
+// connection failures, timeouts and overloaded upstreams, but not missing tiles
+bool isRetryable(const QNetworkReply *reply)
+{
+    if (reply->property("oversized").toBool()) return false;
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status == 0) return reply->error() != QNetworkReply::NoError;
+    return status == 429 || status >= 500;
+}
+
+}
+
+class ImageFetcher::Private
+{
+public:
+    Private(ImageFetcher *parent);
+    ~Private();
+
+    void cancel();
+
+    static DiskCache::Metadata metadata(const QNetworkReply *reply, const DiskCache::Metadata &previous = DiskCache::Metadata());
+    static QImage decode(const QByteArray &data, const char *format = nullptr);
+    static QNetworkReply *get(QNetworkAccessManager *manager, const QUrl &url, const DiskCache::Metadata &validators);
+    static bool isNotModified(const QNetworkReply *reply);
+    static void revalidate(const QUrl &url, const DiskCache::Metadata &metadata);
+    bool lookup(const QUrl &url, QImage *image);
+    void start(const QString &host);
+    void finish(QNetworkReply *reply);
+    void retry(const QUrl &url);
+    void deliver(const QUrl &url, const QImage &image);
+
+    // single-flight: one fetcher per url goes upstream, the others wait for it
+    bool join(const QByteArray &key, const QUrl &url);
+    void complete(const QByteArray &key, const QImage &image);
+    void handOver(const QByteArray &key);
+
+    int maximumConnectionsPerHost;
+    bool staleWhileRevalidate;
+    QHash<QString, QQueue<QUrl>> queued;
+    QHash<QString, int> running;
+    QSet<QUrl> pending;
+    QSet<QNetworkReply *> replies;
+    QHash<QByteArray, QUrl> waiting;
+    QHash<QUrl, int> attempts;
+    QHash<QTimer *, QUrl> retries;
+    // expired copies sent upstream with their validators, used on a 304
+    struct Stale {
+        QByteArray data;
+        DiskCache::Metadata metadata;
+    };
+    QHash<QUrl, Stale> stale;
+
+    static QNetworkAccessManager *networkAccessManager();
+
+    // negative cache, process wide
+    struct Failure {
+        qint64 until;
+        int count;
+    };
+    static bool hasFailed(const QByteArray &key);
+    static void failed(const QByteArray &key);
+    static void succeeded(const QByteArray &key);
+    static QMutex failureMutex;
+    static QHash<QByteArray, Failure> failures;
+
+    struct Flight {
+        Private *leader;
+        QList<Private *> waiters;
+    };
+    static QMutex flightMutex;
+    static QHash<QByteArray, Flight> flights;
+    static QAtomicInteger<quint64> upstreamCount;
+    static QAtomicInteger<quint64> coalescedCount;
+    static QAtomicInteger<quint64> errorCount;
+    static QAtomicInteger<quint64> skippedCount;
+
+private:
+    ImageFetcher *q;
+};
+
+QMutex ImageFetcher::Private::flightMutex;
+QHash<QByteArray, ImageFetcher::Private::Flight> ImageFetcher::Private::flights;
+QAtomicInteger<quint64> ImageFetcher::Private::upstreamCount(0);
+QAtomicInteger<quint64> ImageFetcher::Private::coalescedCount(0);
+QAtomicInteger<quint64> ImageFetcher::Private::errorCount(0);
+QAtomicInteger<quint64> ImageFetcher::Private::skippedCount(0);
+QMutex ImageFetcher::Private::failureMutex;
+QHash<QByteArray, ImageFetcher::Private::Failure> ImageFetcher::Private::failures;
+
+ImageFetcher::Private::Private(ImageFetcher *parent)
+    : maximumConnectionsPerHost(6)
+    , staleWhileRevalidate(true)
+    , q(parent)
+{
+}
+
+ImageFetcher::Private::~Private()
+{
+    cancel();
+}
+
+// Flights this fetcher leads are handed over to their waiters, so that
+// renders with time left still get the images they share with this one.
+void ImageFetcher::Private::cancel()
+{
+    QList<QByteArray> led;
+    for (QNetworkReply *reply : replies) {
+        reply->disconnect(q);
+        reply->abort();
+        reply->deleteLater();
+        led.append(reply->request().url().toEncoded());
+    }
+    for (const QQueue<QUrl> &queue : queued) {
+        for (const QUrl &url : queue) {
+            led.append(url.toEncoded());
+        }
+    }
+    for (auto it = retries.constBegin(); it != retries.constEnd(); ++it) {
+        delete it.key();
+        led.append(it.value().toEncoded());
+    }
+
+    replies.clear();
+    queued.clear();
+    running.clear();
+    pending.clear();
+    attempts.clear();
+    retries.clear();
+    stale.clear();
+
+    QMutexLocker locker(&flightMutex);
+    for (const QByteArray &key : qAsConst(led)) {
+        handOver(key);
+    }
+    // a flight handed to this fetcher that it has not taken up yet
+    for (auto it = waiting.constBegin(); it != waiting.constEnd(); ++it) {
+        auto flight = flights.find(it.key());
+        if (flight == flights.end()) continue;
+        if (flight.value().leader == this) {
+            handOver(it.key());
+        } else {
+            flight.value().waiters.removeAll(this);
+        }
+    }
+    waiting.clear();
+}
+
+// A 304 may leave out the validators, the ones of the cached copy stay valid then.
+DiskCache::Metadata ImageFetcher::Private::metadata(const QNetworkReply *reply, const DiskCache::Metadata &previous)
+{
+    DiskCache::Metadata ret;
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    for (const QByteArray &directive : reply->rawHeader("Cache-Control").split(',')) {
+        const QByteArray value = directive.trimmed().toLower();
+        if (value.startsWith("max-age=")) {
+            bool ok;
+            int seconds = value.mid(8).toInt(&ok);
+            if (ok) ret.expires = now.addSecs(seconds);
+        } else if (value == "no-cache" || value == "no-store") {
+            ret.expires = now;
+        }
+    }
+    if (!ret.expires.isValid() && reply->hasRawHeader("Expires")) {
+        QDateTime expires = QLocale::c().toDateTime(QString::fromLatin1(reply->rawHeader("Expires")), QStringLiteral("ddd, dd MMM yyyy hh:mm:ss 'GMT'"));
+        expires.setTimeSpec(Qt::UTC);
+        if (expires.isValid()) ret.expires = expires;
+    }
+    if (!ret.expires.isValid()) {
+        ret.expires = now.addSecs(DiskCache::instance()->defaultTimeToLive());
+    }
+    ret.lastModified = reply->header(QNetworkRequest::LastModifiedHeader).toDateTime();
+    ret.etag = reply->rawHeader("ETag");
+    if (!ret.lastModified.isValid()) ret.lastModified = previous.lastModified;
+    if (ret.etag.isEmpty()) ret.etag = previous.etag;
+    return ret;
+}
+
+// Images are cached in the formats the compositor draws fastest: opaque ones
+// as RGB32, whose pixels are byte for byte the same as opaque premultiplied
+// ARGB and can be copied into the map as they are, others premultiplied.
+QImage ImageFetcher::Private::decode(const QByteArray &data, const char *format)
+{
+    const QImage image = QImage::fromData(data, format);
+    return image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+}
+
+// QNetworkAccessManager is bound to the thread it lives in, so every render
+// thread keeps its own one and with it its own pool of keep-alive connections.
+QNetworkAccessManager *ImageFetcher::Private::networkAccessManager()
+{
+    static QThreadStorage<QNetworkAccessManager *> storage;
+    if (!storage.hasLocalData()) {
+        storage.setLocalData(new QNetworkAccessManager);
+    }
+    return storage.localData();
+}
+
+// Requests go out conditional when there is an expired copy to fall back
+// on, and give up after UPSTREAM_TIMEOUT_MS or past MAX_IMAGE_SIZE.
+QNetworkReply *ImageFetcher::Private::get(QNetworkAccessManager *manager, const QUrl &url, const DiskCache::Metadata &validators)
+{
+    QNetworkRequest request(url);
+    request.setHeader(QNetworkRequest::UserAgentHeader, QByteArrayLiteral("QGeoTileFetcher"));
+    request.setAttribute(QNetworkRequest::Http2AllowedAttribute, true);
+    if (!validators.etag.isEmpty()) {
+        request.setRawHeader(QByteArrayLiteral("If-None-Match"), validators.etag);
+    }
+    if (validators.lastModified.isValid()) {
+        request.setHeader(QNetworkRequest::IfModifiedSinceHeader, validators.lastModified);
+    }
+    QNetworkReply *reply = manager->get(request);
+    QObject::connect(reply, &QNetworkReply::downloadProgress, reply, [reply](qint64 received, qint64 total) {
+        if (std::max(received, total) > maximumSize()) {
+            reply->setProperty("oversized", true);
+            reply->abort();
+        }
+    });
+    if (timeout() > 0) {
+        QTimer::singleShot(timeout(), reply, [reply]() {
+            if (reply->isRunning()) reply->abort();
+        });
+    }
+    return reply;
+}
+
+bool ImageFetcher::Private::isNotModified(const QNetworkReply *reply)
+{
+    return reply->error() == QNetworkReply::NoError
+            && reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304;
+}
+
+// Stale tiles are refreshed by a thread of their own, so that the refresh
+// outlives the render that found the tile expired.
+void ImageFetcher::Private::revalidate(const QUrl &url, const DiskCache::Metadata &metadata)
+{
+    static QObject *revalidator = [] {
+        QThread *thread = new QThread;
+        thread->setObjectName(QStringLiteral("revalidator"));
+        QObject *ret = new QObject;
+        ret->moveToThread(thread);
+        thread->start();
+        return ret;
+    }();
+    QMetaObject::invokeMethod(revalidator, [url, metadata]() {
+        static QSet<QUrl> running;
+        if (running.contains(url)) return;
+        running.insert(url);
+        QNetworkReply *reply = get(networkAccessManager(), url, metadata);
+        QObject::connect(reply, &QNetworkReply::finished, reply, [reply, url, metadata]() {
+            running.remove(url);
+            reply->deleteLater();
+            const QByteArray key = url.toEncoded();
+            if (isNotModified(reply)) {
+                DiskCache::instance()->updateMetadata(key, Private::metadata(reply, metadata));
+            } else if (reply->error() == QNetworkReply::NoError) {
+                const QByteArray data = reply->readAll();
+                const QImage image = decode(data);
+                if (!image.isNull()) {
+                    const DiskCache::Metadata fetched = Private::metadata(reply);
+                    DiskCache::instance()->insert(key, data, fetched);
+                    ImageCache::instance()->insert(key, image);
+                    share(key, data, fetched);
+                }
+            }
+        });
+    }, Qt::QueuedConnection);
+}
+
+bool ImageFetcher::Private::lookup(const QUrl &url, QImage *image)
+{
+    const QByteArray key = url.toEncoded();
+    *image = ImageCache::instance()->find(key);
+    if (!image->isNull()) return true;
+
+    // local archives are cheaper to read than the disk cache, never copy them there
+    if (TileSource::isLocal(url)) {
+        *image = decode(TileSource::read(url, maximumSize()));
+        ImageCache::instance()->insert(key, *image);
+        return true;
+    }
+
+    if (url.scheme() == QStringLiteral("qrc")) {
+        QString format = QFileInfo(url.path()).suffix();
+        QFile file(QStringLiteral(":") + url.toString().mid(6));
+        if (file.open(QFile::ReadOnly)) {
+            *image = decode(file.readAll(), qPrintable(format));
+            file.close();
+        }
+        ImageCache::instance()->insert(key, *image);
+        return true;
+    }
+
+    // what another worker process fetched
+    if (SharedTileCache *shared = SharedTileCache::instance()) {
+        const QByteArray data = shared->find(key);
+        if (!data.isEmpty()) {
+            *image = decode(data);
+            if (!image->isNull()) {
+                ImageCache::instance()->insert(key, *image);
+                return true;
+            }
+        }
+    }
+
+    // Expired tiles are served as they are while a refresh runs in the
+    // background, unless they are too old; those are revalidated first.
+    bool expired = false;
+    DiskCache::Metadata metadata;
+    const QByteArray data = DiskCache::instance()->find(key, &metadata, &expired);
+    if (data.isEmpty()) return false;
+    if (expired && (!staleWhileRevalidate || metadata.expires.secsTo(QDateTime::currentDateTimeUtc()) > maximumStale())) {
+        stale.insert(url, Stale { data, metadata });
+        return false;
+    }
+    *image = decode(data);
+    if (image->isNull()) {
+        DiskCache::instance()->remove(key);
+        return false;
+    }
+    ImageCache::instance()->insert(key, *image);
+    if (expired) {
+        revalidate(url, metadata);
+    } else {
+        share(key, data, metadata);
+    }
+    return true;
+}
+
+void ImageFetcher::Private::start(const QString &host)
+{
+    QQueue<QUrl> &queue = queued[host];
+    int &count = running[host];
+    while (!queue.isEmpty() && count < maximumConnectionsPerHost) {
+        const QUrl url = queue.dequeue();
+        QNetworkReply *reply = get(networkAccessManager(), url, stale.value(url).metadata);
+        replies.insert(reply);
+        count++;
+        QObject::connect(reply, &QNetworkReply::finished, q, [this, reply]() {
+            finish(reply);
+        });
+    }
+    if (queue.isEmpty()) {
+        queued.remove(host);
+    }
+}
+
+void ImageFetcher::Private::finish(QNetworkReply *reply)
+{
+    replies.remove(reply);
+    reply->deleteLater();
+
+    QUrl url = reply->request().url();
+    QString host = url.host();
+    running[host]--;
+
+    const QByteArray key = url.toEncoded();
+    QImage image;
+    if (isNotModified(reply) && stale.contains(url)) {
+        const Stale copy = stale.value(url);
+        image = decode(copy.data);
+        if (!image.isNull()) {
+            const DiskCache::Metadata updated = metadata(reply, copy.metadata);
+            DiskCache::instance()->updateMetadata(key, updated);
+            ImageCache::instance()->insert(key, image);
+            share(key, copy.data, updated);
+        }
+    } else if (reply->error() == QNetworkReply::NoError) {
+        const QByteArray data = reply->readAll();
+        image = decode(data);
+        if (!image.isNull()) {
+            const DiskCache::Metadata fetched = metadata(reply);
+            DiskCache::instance()->insert(key, data, fetched);
+            ImageCache::instance()->insert(key, image);
+            share(key, data, fetched);
+        }
+    } else if (isRetryable(reply) && attempts.value(url) < maximumRetries()) {
+        retry(url);
+        start(host);
+        return;
+    }
+    if (image.isNull()) {
+        errorCount.fetchAndAddRelaxed(1);
+        failed(key);
+        // an expired copy is better than nothing
+        if (stale.contains(url)) {
+            image = decode(stale.value(url).data);
+        }
+    } else {
+        succeeded(key);
+    }
+
+    attempts.remove(url);
+    stale.remove(url);
+    complete(key, image);
+    start(host);
+    deliver(url, image);
+}
+
+void ImageFetcher::Private::retry(const QUrl &url)
+{
+    const int attempt = attempts.value(url);
+    attempts.insert(url, attempt + 1);
+    QTimer *timer = new QTimer(q);
+    timer->setSingleShot(true);
+    QObject::connect(timer, &QTimer::timeout, q, [this, timer]() {
+        const QUrl url = retries.take(timer);
+        timer->deleteLater();
+        queued[url.host()].enqueue(url);
+        start(url.host());
+    });
+    retries.insert(timer, url);
+    timer->start(retryDelay(attempt));
+}
+
+void ImageFetcher::Private::deliver(const QUrl &url, const QImage &image)
+{
+    pending.remove(url);
+    emit q->imageReady(url, image);
+    if (pending.isEmpty()) {
+        emit q->finished();
+    }
+}
+
+bool ImageFetcher::Private::hasFailed(const QByteArray &key)
+{
+    QMutexLocker locker(&failureMutex);
+    auto it = failures.constFind(key);
+    return it != failures.constEnd() && it.value().until > QDateTime::currentMSecsSinceEpoch();
+}
+
+// Failures are remembered past their ttl to grow the next one; old ones are
+// dropped once there are many.
+void ImageFetcher::Private::failed(const QByteArray &key)
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QMutexLocker locker(&failureMutex);
+    if (failures.size() > 65536) {
+        const qint64 forgotten = now - negativeTimeToLive(std::numeric_limits<int>::max()) * Q_INT64_C(1000);
+        for (auto it = failures.begin(); it != failures.end();) {
+            it = it.value().until < forgotten ? failures.erase(it) : std::next(it);
+        }
+    }
+    Failure &failure = failures[key];
+    failure.count = std::min(failure.count + 1, 64);
+    failure.until = now + negativeTimeToLive(failure.count) * Q_INT64_C(1000);
+}
+
+void ImageFetcher::Private::succeeded(const QByteArray &key)
+{
+    QMutexLocker locker(&failureMutex);
+    failures.remove(key);
+}
+
+bool ImageFetcher::Private::join(const QByteArray &key, const QUrl &url)
+{
+    QMutexLocker locker(&flightMutex);
+    auto it = flights.find(key);
+    if (it == flights.end()) {
+        flights.insert(key, Flight { this, QList<Private *>() });
+        upstreamCount.fetchAndAddRelaxed(1);
+        return true;
+    }
+    it.value().waiters.append(this);
+    waiting.insert(key, url);
+    coalescedCount.fetchAndAddRelaxed(1);
+    return false;
+}
+
+// Waiters are notified through their own event loop while the lock is held,
+// so a waiter that is being destroyed cannot be posted to.
+void ImageFetcher::Private::complete(const QByteArray &key, const QImage &image)
+{
+    QMutexLocker locker(&flightMutex);
+    const QList<Private *> waiters = flights.take(key).waiters;
+    for (Private *waiter : waiters) {
+        QMetaObject::invokeMethod(waiter->q, [waiter, key, image]() {
+            const QUrl url = waiter->waiting.take(key);
+            if (!url.isEmpty()) {
+                waiter->deliver(url, image);
+            }
+        }, Qt::QueuedConnection);
+    }
+}
+
+// The first waiter leads the flight on and sends a request of its own; a
+// flight nobody waits for ends. Called with the lock held, see complete().
+void ImageFetcher::Private::handOver(const QByteArray &key)
+{
+    auto it = flights.find(key);
+    if (it == flights.end()) return;
+    if (it.value().waiters.isEmpty()) {
+        flights.erase(it);
+        return;
+    }
+    Private *leader = it.value().waiters.takeFirst();
+    it.value().leader = leader;
+    QMetaObject::invokeMethod(leader->q, [leader, key]() {
+        const QUrl url = leader->waiting.take(key);
+        if (url.isEmpty()) return;
+        leader->queued[url.host()].enqueue(url);
+        leader->start(url.host());
+    }, Qt::QueuedConnection);
+}
+
+ImageFetcher::ImageFetcher(QObject *parent)
+    : QObject(parent)
+    , d(new Private(this))
+{
+}
+
+ImageFetcher::~ImageFetcher()
+{
+    delete d;
+}
+
+int ImageFetcher::maximumConnectionsPerHost() const
+{
+    return d->maximumConnectionsPerHost;
+}
+
+void ImageFetcher::setMaximumConnectionsPerHost(int maximumConnectionsPerHost)
+{
+    d->maximumConnectionsPerHost = std::max(1, maximumConnectionsPerHost);
+}
+
+bool ImageFetcher::staleWhileRevalidate() const
+{
+    return d->staleWhileRevalidate;
+}
+
+void ImageFetcher::setStaleWhileRevalidate(bool staleWhileRevalidate)
+{
+    d->staleWhileRevalidate = staleWhileRevalidate;
+}
+
+bool ImageFetcher::isFinished() const
+{
+    return d->pending.isEmpty();
+}
+
+void ImageFetcher::fetch(const QUrl &url)
+{
+    if (d->pending.contains(url)) return;
+
+    QImage image;
+    if (d->lookup(url, &image)) {
+        emit imageReady(url, image);
+        return;
+    }
+
+    const QByteArray key = url.toEncoded();
+    if (Private::hasFailed(key)) {
+        Private::skippedCount.fetchAndAddRelaxed(1);
+        if (d->stale.contains(url)) {
+            image = Private::decode(d->stale.take(url).data);
+        }
+        emit imageReady(url, image);
+        return;
+    }
+
+    d->pending.insert(url);
+    if (!d->join(key, url)) return;
+
+    // the previous flight may have finished between the lookup and the join
+    image = ImageCache::instance()->find(key);
+    if (!image.isNull()) {
+        d->complete(key, image);
+        d->deliver(url, image);
+        return;
+    }
+
+    d->queued[url.host()].enqueue(url);
+    d->start(url.host());
+}
+
+// Without going upstream: memory, local sources, the shared and the disk
+// cache, expired entries included.
+QImage ImageFetcher::cached(const QUrl &url)
+{
+    const QByteArray key = url.toEncoded();
+    QImage ret = ImageCache::instance()->find(key);
+    if (!ret.isNull()) return ret;
+    QByteArray data;
+    if (TileSource::isLocal(url)) {
+        data = TileSource::read(url, maximumSize());
+    } else {
+        if (SharedTileCache::instance()) {
+            data = SharedTileCache::instance()->find(key);
+        }
+        if (data.isEmpty()) {
+            data = DiskCache::instance()->find(key);
+        }
+    }
+    if (data.isEmpty()) return ret;
+    ret = Private::decode(data);
+    if (!ret.isNull()) {
+        ImageCache::instance()->insert(key, ret);
+    }
+    return ret;
+}
+
+ImageFetcher::Statistics ImageFetcher::statistics()
+{
+    Statistics ret;
+    ret.upstream = Private::upstreamCount.loadAcquire();
+    ret.coalesced = Private::coalescedCount.loadAcquire();
+    ret.errors = Private::errorCount.loadAcquire();
+    ret.skipped = Private::skippedCount.loadAcquire();
+    return ret;
+}
+
+bool ImageFetcher::waitForFinished(int msecs)
+{
+    if (isFinished()) return true;
+    QEventLoop loop;
+    connect(this, &ImageFetcher::finished, &loop, &QEventLoop::quit);
+    if (msecs >= 0) {
+        QTimer::singleShot(msecs, &loop, &QEventLoop::quit);
+    }
+    loop.exec();
+    return isFinished();
+}
+
+void ImageFetcher::cancel()
+{
+    d->cancel();
+}
@@ -0,0 +1,53 @@
+#ifndef IMAGEFETCHER_H
+#define IMAGEFETCHER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QUrl>
+#include <QtGui/QImage>
+
+class ImageFetcher : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(int maximumConnectionsPerHost READ maximumConnectionsPerHost WRITE setMaximumConnectionsPerHost)
+    Q_PROPERTY(bool staleWhileRevalidate READ staleWhileRevalidate WRITE setStaleWhileRevalidate)
+public:
+    struct Statistics {
+        quint64 upstream;
+        quint64 coalesced;
+        quint64 errors;
+        // fetches answered from the negative cache
+        quint64 skipped;
+    };
+
+    explicit ImageFetcher(QObject *parent = nullptr);
+    ~ImageFetcher() override;
+
+    int maximumConnectionsPerHost() const;
+    // Expired images are delivered right away and refreshed in the
+    // background. Without, they are revalidated before they are delivered.
+    bool staleWhileRevalidate() const;
+    bool isFinished() const;
+
+    static Statistics statistics();
+    static QImage cached(const QUrl &url);
+
+public slots:
+    void setMaximumConnectionsPerHost(int maximumConnectionsPerHost);
+    void setStaleWhileRevalidate(bool staleWhileRevalidate);
+
+    void fetch(const QUrl &url);
+    // returns false if images are still pending after msecs
+    bool waitForFinished(int msecs = -1);
+    // drops everything pending without delivering it
+    void cancel();
+
+signals:
+    void imageReady(const QUrl &url, const QImage &image);
+    void finished();
+
+private:
+    class Private;
+    Private *d;
+};
+
+#endif // IMAGEFETCHER_H
@@ -0,0 +1,80 @@
+#include "labelcache.h"
+#include "environment.h"
+
+#include <QtCore/QCache>
+#include <QtCore/QMutex>
+
+#include <QtGui/QFontMetrics>
+#include <QtGui/QPainter>
+
+#include <algorithm>
+#include <limits>
+
+class LabelCache::Private
+{
+public:
+    static QImage render(const QString &text, const QFont &font, const QColor &color, int scale);
+
+    QMutex mutex;
+    QCache<QString, QImage> cache;
+};
+
+QImage LabelCache::Private::render(const QString &text, const QFont &font, const QColor &color, int scale)
+{
+    const QSize size = QFontMetrics(font).size(0, text);
+    if (size.isEmpty()) return QImage();
+
+    QImage ret(size * scale, QImage::Format_ARGB32_Premultiplied);
+    ret.fill(Qt::transparent);
+    ret.setDevicePixelRatio(scale);
+    QPainter painter(&ret);
+    painter.setFont(font);
+    painter.setPen(color);
+    painter.drawText(QRect(QPoint(0, 0), size), Qt::AlignCenter, text);
+    painter.end();
+    return ret;
+}
+
+LabelCache::LabelCache(qint64 maximumBytes)
+    : d(new Private)
+{
+    d->cache.setMaxCost(static_cast<int>(std::min<qint64>(maximumBytes / 1024, std::numeric_limits<int>::max())));
+}
+
+LabelCache::~LabelCache()
+{
+    delete d;
+}
+
+LabelCache *LabelCache::instance()
+{
+    static LabelCache cache(environment("LABEL_CACHE_SIZE", 16) * Q_INT64_C(1024) * 1024);
+    return &cache;
+}
+
+// Rendering happens outside the lock; two renders missing the same label at
+// once both draw it and the second insert wins.
+QImage LabelCache::label(const QString &text, const QFont &font, const QColor &color, int scale)
+{
+    const QString key = font.key() + QLatin1Char('\x1f') + QString::number(color.rgba(), 16)
+            + QLatin1Char('\x1f') + QString::number(scale) + QLatin1Char('\x1f') + text;
+    {
+        QMutexLocker locker(&d->mutex);
+        if (const QImage *image = d->cache.object(key)) {
+            return *image;
+        }
+    }
+
+    const QImage ret = Private::render(text, font, color, scale);
+    if (!ret.isNull()) {
+        QMutexLocker locker(&d->mutex);
+        d->cache.insert(key, new QImage(ret), std::max(1, static_cast<int>(ret.sizeInBytes() / 1024)));
+    }
+    return ret;
+}
+
+void LabelCache::clear()
+{
+    QMutexLocker locker(&d->mutex);
+    d->cache.clear();
+}
@@ -0,0 +1,30 @@
+#ifndef LABELCACHE_H
+#define LABELCACHE_H
+
+#include <QtCore/QString>
+#include <QtGui/QColor>
+#include <QtGui/QFont>
+#include <QtGui/QImage>
+
+// Pre-rendered labels shared by all renders, so that a label seen before is
+// only blitted. A label is looked up by its text, font, color and scale and
+// rendered on a miss.
+class LabelCache
+{
+public:
+    explicit LabelCache(qint64 maximumBytes);
+    ~LabelCache();
+
+    static LabelCache *instance();
+
+    // premultiplied, with the scale as its device pixel ratio
+    QImage label(const QString &text, const QFont &font, const QColor &color, int scale);
+    void clear();
+
+private:
+    Q_DISABLE_COPY(LabelCache)
+    class Private;
+    Private *d;
+};
+
+#endif // LABELCACHE_H
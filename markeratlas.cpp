@@ -0,0 +1,258 @@
+#include "markeratlas.h"
+#include "environment.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QPair>
+#include <QtCore/QVector>
+
+#include <QtGui/QPainter>
+#include <QtGui/QPainterPath>
+
+#include <algorithm>
+
+namespace {
+
+const int pageSize = 1024;
+const int padding = 1;
+
+// Google's pin sizes in logical pixels; only mid pins carry a label.
+QSize pinSize(MarkerAtlas::PinSize size)
+{
+    switch (size) {
+    case MarkerAtlas::Tiny: return QSize(12, 20);
+    case MarkerAtlas::Small: return QSize(16, 26);
+    case MarkerAtlas::Mid: break;
+    }
+    return QSize(22, 36);
+}
+
+QImage drawPin(const QColor &color, MarkerAtlas::PinSize size, QChar label, int scale)
+{
+    const QSize logical = pinSize(size);
+    QImage ret(logical * scale + QSize(2, 2), QImage::Format_ARGB32_Premultiplied);
+    ret.fill(Qt::transparent);
+
+    const qreal w = logical.width();
+    const qreal h = logical.height();
+    const qreal r = w / 2;
+    QPainterPath shape;
+    shape.moveTo(r, h);
+    shape.cubicTo(r - r * 0.2, h - r * 0.9, 0, r * 1.6, 0, r);
+    shape.arcTo(QRectF(0, 0, w, w), 180, -180);
+    shape.cubicTo(w, r * 1.6, r + r * 0.2, h - r * 0.9, r, h);
+    shape.closeSubpath();
+
+    QPainter painter(&ret);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.translate(1, 1);
+    painter.scale(scale, scale);
+    painter.setPen(QPen(color.darker(150), 1));
+    painter.setBrush(color);
+    painter.drawPath(shape);
+    if (size == MarkerAtlas::Mid && !label.isNull()) {
+        QFont font = painter.font();
+        font.setBold(true);
+        font.setPixelSize(qRound(r));
+        painter.setFont(font);
+        painter.setPen(Qt::black);
+        painter.drawText(QRectF(0, 0, w, w), Qt::AlignCenter, QString(label));
+    } else {
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(color.darker(200));
+        painter.drawEllipse(QPointF(r, r), r / 3, r / 3);
+    }
+    painter.end();
+    return ret;
+}
+
+}
+
+class MarkerAtlas::Private
+{
+public:
+    // sprites refer to pages by id, so that only renders hold copies of a
+    // page and a page can be dropped with the sprites on it
+    struct Entry {
+        int page;
+        QRect rect;
+        QPoint anchor;
+    };
+    // Renders share the image. New sprites are drawn through the canvas, a
+    // second image over the same pixels, which never detaches; they go where
+    // no sprite handed out is, so renders never see pixels change.
+    struct Page {
+        QImage image;
+        QImage canvas;
+        quint64 used;
+    };
+
+    Entry insert(const QImage &image, const QPoint &anchor);
+    Sprite sprite(const Entry &entry);
+    int addPage(const QImage &image, const QImage &canvas = QImage());
+    void evict();
+    void clearLocked();
+
+    int maximumPages;
+    QMutex mutex;
+    QHash<int, Page> pages;
+    int nextPage;
+    quint64 clock;
+    // the page being filled and its current shelf, -1 when there is none
+    int open;
+    QPoint cursor;
+    int shelfHeight;
+    QHash<QPair<QUrl, int>, Entry> icons;
+    QHash<quint64, Entry> pins;
+};
+
+// Shelf packing: sprites are placed left to right, a new shelf starts below
+// the tallest sprite of the current one and a new page when that is full.
+// Sprites larger than a page get a page of their own.
+MarkerAtlas::Private::Entry MarkerAtlas::Private::insert(const QImage &image, const QPoint &anchor)
+{
+    const QSize size = image.size() + QSize(padding, padding);
+    if (size.width() > pageSize || size.height() > pageSize) {
+        return Entry { addPage(image.convertToFormat(QImage::Format_ARGB32_Premultiplied)), image.rect(), anchor };
+    }
+
+    if (open >= 0 && cursor.x() + size.width() > pageSize) {
+        cursor = QPoint(0, cursor.y() + shelfHeight);
+        shelfHeight = 0;
+    }
+    if (open < 0 || cursor.y() + size.height() > pageSize) {
+        QImage page(pageSize, pageSize, QImage::Format_ARGB32_Premultiplied);
+        page.fill(Qt::transparent);
+        const QImage canvas(page.bits(), page.width(), page.height(), page.bytesPerLine(), page.format());
+        open = addPage(page, canvas);
+        cursor = QPoint(0, 0);
+        shelfHeight = 0;
+    }
+
+    const QRect rect(cursor, image.size());
+    QPainter painter(&pages[open].canvas);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(rect.topLeft(), image);
+    painter.end();
+    cursor.rx() += size.width();
+    shelfHeight = std::max(shelfHeight, size.height());
+    return Entry { open, rect, anchor };
+}
+
+MarkerAtlas::Sprite MarkerAtlas::Private::sprite(const Entry &entry)
+{
+    Page &page = pages[entry.page];
+    page.used = ++clock;
+    return Sprite { page.image, entry.rect, entry.anchor };
+}
+
+int MarkerAtlas::Private::addPage(const QImage &image, const QImage &canvas)
+{
+    while (pages.size() >= maximumPages) {
+        evict();
+    }
+    pages.insert(nextPage, Page { image, canvas, ++clock });
+    return nextPage++;
+}
+
+// Drops the least recently used page and the sprites on it; renders
+// holding it keep their copy.
+void MarkerAtlas::Private::evict()
+{
+    auto victim = pages.begin();
+    for (auto it = pages.begin(); it != pages.end(); ++it) {
+        if (it.value().used < victim.value().used) victim = it;
+    }
+    const int page = victim.key();
+    pages.erase(victim);
+    if (page == open) open = -1;
+    for (auto it = icons.begin(); it != icons.end();) {
+        it = it.value().page == page ? icons.erase(it) : it + 1;
+    }
+    for (auto it = pins.begin(); it != pins.end();) {
+        it = it.value().page == page ? pins.erase(it) : it + 1;
+    }
+}
+
+void MarkerAtlas::Private::clearLocked()
+{
+    pages.clear();
+    icons.clear();
+    pins.clear();
+    open = -1;
+    cursor = QPoint();
+    shelfHeight = 0;
+}
+
+MarkerAtlas::MarkerAtlas(qint64 maximumBytes)
+    : d(new Private)
+{
+    d->maximumPages = static_cast<int>(std::max<qint64>(1, maximumBytes / (pageSize * pageSize * 4)));
+    d->nextPage = 0;
+    d->clock = 0;
+    d->open = -1;
+    d->shelfHeight = 0;
+}
+
+MarkerAtlas::~MarkerAtlas()
+{
+    delete d;
+}
+
+MarkerAtlas *MarkerAtlas::instance()
+{
+    static MarkerAtlas atlas(environment("MARKER_ATLAS_SIZE", 16) * Q_INT64_C(1024) * 1024);
+    return &atlas;
+}
+
+MarkerAtlas::Sprite MarkerAtlas::icon(const QUrl &url, int scale) const
+{
+    QMutexLocker locker(&d->mutex);
+    auto it = d->icons.constFind(qMakePair(url, scale));
+    return it != d->icons.constEnd() ? d->sprite(*it) : Sprite();
+}
+
+MarkerAtlas::Sprite MarkerAtlas::insertIcon(const QUrl &url, const QImage &image, int scale)
+{
+    if (image.isNull()) return Sprite();
+    QImage scaled = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    if (scale > 1) {
+        scaled = scaled.scaled(image.size() * scale, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+    const QPoint anchor(scaled.width() / 2, scaled.height() / 2);
+
+    QMutexLocker locker(&d->mutex);
+    const auto key = qMakePair(url, scale);
+    auto it = d->icons.constFind(key);
+    if (it == d->icons.constEnd()) {
+        it = d->icons.insert(key, d->insert(scaled, anchor));
+    }
+    return d->sprite(*it);
+}
+
+MarkerAtlas::Sprite MarkerAtlas::pin(const QColor &color, PinSize size, QChar label, int scale)
+{
+    const quint64 key = static_cast<quint64>(color.rgba()) << 32 | static_cast<quint64>(label.unicode()) << 16
+            | static_cast<quint64>(size & 0xff) << 8 | static_cast<quint64>(scale & 0xff);
+    {
+        QMutexLocker locker(&d->mutex);
+        auto it = d->pins.constFind(key);
+        if (it != d->pins.constEnd()) return d->sprite(*it);
+    }
+
+    const QImage image = drawPin(color, size, label, scale);
+    const QPoint anchor(image.width() / 2, image.height() - 1);
+
+    QMutexLocker locker(&d->mutex);
+    auto it = d->pins.constFind(key);
+    if (it == d->pins.constEnd()) {
+        it = d->pins.insert(key, d->insert(image, anchor));
+    }
+    return d->sprite(*it);
+}
+
+void MarkerAtlas::clear()
+{
+    QMutexLocker locker(&d->mutex);
+    d->clearLocked();
+}
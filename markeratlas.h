@@ -0,0 +1,48 @@
+#ifndef MARKERATLAS_H
+#define MARKERATLAS_H
+
+#include <QtCore/QUrl>
+#include <QtGui/QColor>
+#include <QtGui/QImage>
+
+// Marker sprites shared by all renders, packed into large premultiplied
+// pages so that drawing a marker is a copy of a sub-rect. Sprites are kept
+// at device pixels for the scale they were made for, so they are drawn
+// without a transform.
+class MarkerAtlas
+{
+public:
+    struct Sprite {
+        QImage page;
+        QRect rect;
+        // the point put on the coordinate, relative to the sprite
+        QPoint anchor;
+        bool isNull() const { return page.isNull(); }
+    };
+
+    enum PinSize {
+        Tiny,
+        Small,
+        Mid,
+    };
+
+    explicit MarkerAtlas(qint64 maximumBytes);
+    ~MarkerAtlas();
+
+    static MarkerAtlas *instance();
+
+    // icons are anchored at their center
+    Sprite icon(const QUrl &url, int scale) const;
+    Sprite insertIcon(const QUrl &url, const QImage &image, int scale);
+    // built-in pins are drawn on first use and anchored at their tip
+    Sprite pin(const QColor &color, PinSize size, QChar label, int scale);
+
+    void clear();
+
+private:
+    Q_DISABLE_COPY(MarkerAtlas)
+    class Private;
+    Private *d;
+};
+
+#endif // MARKERATLAS_H
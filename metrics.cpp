@@ -0,0 +1,216 @@
+#include "metrics.h"
+#include "baselayercache.h"
+#include "diskcache.h"
+#include "environment.h"
+#include "imagecache.h"
+#include "imagefetcher.h"
+#include "responsecache.h"
+#include "sharedtilecache.h"
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QDebug>
+
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
+
+namespace {
+
+// upper bounds in seconds, the last bucket is +Inf
+const double bounds[] = { 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+const int bucketCount = std::extent<decltype(bounds)>::value + 1;
+
+class Histogram
+{
+public:
+    void observe(qint64 nanoseconds)
+    {
+        const double seconds = nanoseconds / 1e9;
+        const int bucket = static_cast<int>(std::lower_bound(std::begin(bounds), std::end(bounds), seconds) - std::begin(bounds));
+        counts[bucket].fetchAndAddRelaxed(1);
+        sum.fetchAndAddRelaxed(static_cast<quint64>(std::max<qint64>(0, nanoseconds)));
+    }
+
+    void write(QByteArray *out, const QByteArray &name, const QByteArray &labels) const
+    {
+        const QByteArray prefix = labels.isEmpty() ? QByteArray() : labels + ',';
+        quint64 cumulative = 0;
+        for (int i = 0; i < bucketCount; i++) {
+            cumulative += counts[i].loadAcquire();
+            const QByteArray bound = i < bucketCount - 1 ? QByteArray::number(bounds[i]) : QByteArrayLiteral("+Inf");
+            *out += name + "_bucket{" + prefix + "le=\"" + bound + "\"} " + QByteArray::number(cumulative) + '\n';
+        }
+        const QByteArray suffix = labels.isEmpty() ? QByteArray() : '{' + labels + '}';
+        *out += name + "_sum" + suffix + ' ' + QByteArray::number(sum.loadAcquire() / 1e9, 'f', 6) + '\n';
+        *out += name + "_count" + suffix + ' ' + QByteArray::number(cumulative) + '\n';
+    }
+
+private:
+    QAtomicInteger<quint64> counts[bucketCount];
+    QAtomicInteger<quint64> sum;
+};
+
+void header(QByteArray *out, const char *name, const char *type, const char *help)
+{
+    *out += QByteArrayLiteral("# HELP ") + name + ' ' + help + '\n';
+    *out += QByteArrayLiteral("# TYPE ") + name + ' ' + type + '\n';
+}
+
+void sample(QByteArray *out, const char *name, const QByteArray &labels, qint64 value)
+{
+    *out += name;
+    if (!labels.isEmpty()) *out += '{' + labels + '}';
+    *out += ' ' + QByteArray::number(value) + '\n';
+}
+
+}
+
+class Metrics::Private
+{
+public:
+    Private();
+
+    int slowRequestThreshold;
+    QAtomicInteger<quint64> cachedRequests;
+    QAtomicInteger<quint64> renderedRequests;
+    QAtomicInteger<int> rendersInFlight;
+    QAtomicInteger<quint64> outputBytes;
+    Histogram requests;
+    Histogram parse;
+    Histogram fetch;
+    Histogram composite;
+    Histogram encode;
+};
+
+Metrics::Private::Private()
+    : slowRequestThreshold(environment("SLOW_REQUEST_MS", 1000))
+    , cachedRequests(0)
+    , renderedRequests(0)
+    , rendersInFlight(0)
+    , outputBytes(0)
+{
+}
+
+Metrics::Metrics()
+    : d(new Private)
+{
+}
+
+Metrics::~Metrics()
+{
+    delete d;
+}
+
+Metrics *Metrics::instance()
+{
+    static Metrics metrics;
+    return &metrics;
+}
+
+void Metrics::renderStarted()
+{
+    d->rendersInFlight.fetchAndAddRelaxed(1);
+}
+
+void Metrics::renderFinished(const Timings &timings)
+{
+    d->rendersInFlight.fetchAndAddRelaxed(-1);
+    d->parse.observe(timings.parse);
+    d->fetch.observe(timings.fetch);
+    d->composite.observe(timings.composite);
+    d->encode.observe(timings.encode);
+}
+
+void Metrics::requestFinished(const QUrl &url, bool cached, qint64 elapsed, const Timings &timings)
+{
+    (cached ? d->cachedRequests : d->renderedRequests).fetchAndAddRelaxed(1);
+    d->requests.observe(elapsed);
+
+    if (d->slowRequestThreshold > 0 && elapsed / 1000000 >= d->slowRequestThreshold) {
+        qWarning().noquote() << QStringLiteral("slow request %1 ms (parse %2, fetch %3, composite %4, encode %5): %6")
+                                .arg(elapsed / 1e6, 0, 'f', 1)
+                                .arg(timings.parse / 1e6, 0, 'f', 1)
+                                .arg(timings.fetch / 1e6, 0, 'f', 1)
+                                .arg(timings.composite / 1e6, 0, 'f', 1)
+                                .arg(timings.encode / 1e6, 0, 'f', 1)
+                                .arg(url.toString());
+    }
+}
+
+void Metrics::addOutputBytes(qint64 bytes)
+{
+    d->outputBytes.fetchAndAddRelaxed(static_cast<quint64>(bytes));
+}
+
+QByteArray Metrics::exposition() const
+{
+    QByteArray ret;
+    ret.reserve(8192);
+
+    header(&ret, "qstaticmap_requests_total", "counter", "Map requests by response cache result.");
+    sample(&ret, "qstaticmap_requests_total", QByteArrayLiteral("cache=\"hit\""), d->cachedRequests.loadAcquire());
+    sample(&ret, "qstaticmap_requests_total", QByteArrayLiteral("cache=\"miss\""), d->renderedRequests.loadAcquire());
+    header(&ret, "qstaticmap_renders_in_flight", "gauge", "Renders queued or running.");
+    sample(&ret, "qstaticmap_renders_in_flight", QByteArray(), d->rendersInFlight.loadAcquire());
+    header(&ret, "qstaticmap_output_bytes_total", "counter", "Encoded image bytes sent.");
+    sample(&ret, "qstaticmap_output_bytes_total", QByteArray(), static_cast<qint64>(d->outputBytes.loadAcquire()));
+
+    header(&ret, "qstaticmap_request_duration_seconds", "histogram", "Time from request to response.");
+    d->requests.write(&ret, "qstaticmap_request_duration_seconds", QByteArray());
+    header(&ret, "qstaticmap_stage_duration_seconds", "histogram", "Time spent in each stage of a render.");
+    d->parse.write(&ret, "qstaticmap_stage_duration_seconds", QByteArrayLiteral("stage=\"parse\""));
+    d->fetch.write(&ret, "qstaticmap_stage_duration_seconds", QByteArrayLiteral("stage=\"fetch\""));
+    d->composite.write(&ret, "qstaticmap_stage_duration_seconds", QByteArrayLiteral("stage=\"composite\""));
+    d->encode.write(&ret, "qstaticmap_stage_duration_seconds", QByteArrayLiteral("stage=\"encode\""));
+
+    const ImageCache::Statistics memory = ImageCache::instance()->statistics();
+    const DiskCache::Statistics disk = DiskCache::instance()->statistics();
+    const ResponseCache::Statistics response = ResponseCache::instance()->statistics();
+    const BaseLayerCache::Statistics base = BaseLayerCache::instance()->statistics();
+    const QByteArray memoryLabel = QByteArrayLiteral("cache=\"memory\"");
+    const QByteArray diskLabel = QByteArrayLiteral("cache=\"disk\"");
+    const QByteArray responseLabel = QByteArrayLiteral("cache=\"response\"");
+    const QByteArray baseLabel = QByteArrayLiteral("cache=\"base\"");
+    // only with --workers; hits and misses are per worker, the entries those of all workers
+    SharedTileCache *sharedCache = SharedTileCache::instance();
+    const SharedTileCache::Statistics shared = sharedCache ? sharedCache->statistics() : SharedTileCache::Statistics();
+    const QByteArray sharedLabel = QByteArrayLiteral("cache=\"shared\"");
+    header(&ret, "qstaticmap_cache_hits_total", "counter", "Cache lookups that found an entry.");
+    sample(&ret, "qstaticmap_cache_hits_total", memoryLabel, static_cast<qint64>(memory.hits));
+    sample(&ret, "qstaticmap_cache_hits_total", diskLabel, static_cast<qint64>(disk.hits));
+    sample(&ret, "qstaticmap_cache_hits_total", responseLabel, static_cast<qint64>(response.hits));
+    sample(&ret, "qstaticmap_cache_hits_total", baseLabel, static_cast<qint64>(base.hits));
+    if (sharedCache) sample(&ret, "qstaticmap_cache_hits_total", sharedLabel, static_cast<qint64>(shared.hits));
+    header(&ret, "qstaticmap_cache_misses_total", "counter", "Cache lookups that found nothing.");
+    sample(&ret, "qstaticmap_cache_misses_total", memoryLabel, static_cast<qint64>(memory.misses));
+    sample(&ret, "qstaticmap_cache_misses_total", diskLabel, static_cast<qint64>(disk.misses));
+    sample(&ret, "qstaticmap_cache_misses_total", responseLabel, static_cast<qint64>(response.misses));
+    sample(&ret, "qstaticmap_cache_misses_total", baseLabel, static_cast<qint64>(base.misses));
+    if (sharedCache) sample(&ret, "qstaticmap_cache_misses_total", sharedLabel, static_cast<qint64>(shared.misses));
+    header(&ret, "qstaticmap_cache_evictions_total", "counter", "Entries dropped to stay within the size limit.");
+    sample(&ret, "qstaticmap_cache_evictions_total", memoryLabel, static_cast<qint64>(memory.evictions));
+    sample(&ret, "qstaticmap_cache_evictions_total", diskLabel, static_cast<qint64>(disk.evictions));
+    header(&ret, "qstaticmap_cache_bytes", "gauge", "Bytes held by the cache.");
+    sample(&ret, "qstaticmap_cache_bytes", memoryLabel, memory.bytes);
+    sample(&ret, "qstaticmap_cache_bytes", diskLabel, disk.bytes);
+    sample(&ret, "qstaticmap_cache_bytes", responseLabel, response.bytes);
+    sample(&ret, "qstaticmap_cache_bytes", baseLabel, base.bytes);
+    if (sharedCache) sample(&ret, "qstaticmap_cache_bytes", sharedLabel, shared.bytes);
+    header(&ret, "qstaticmap_cache_entries", "gauge", "Entries held by the cache.");
+    sample(&ret, "qstaticmap_cache_entries", memoryLabel, memory.count);
+    sample(&ret, "qstaticmap_cache_entries", diskLabel, disk.count);
+    sample(&ret, "qstaticmap_cache_entries", responseLabel, response.count);
+    sample(&ret, "qstaticmap_cache_entries", baseLabel, base.count);
+    if (sharedCache) sample(&ret, "qstaticmap_cache_entries", sharedLabel, shared.count);
+
+    const ImageFetcher::Statistics upstream = ImageFetcher::statistics();
+    header(&ret, "qstaticmap_upstream_requests_total", "counter", "Requests sent to tile and icon servers.");
+    sample(&ret, "qstaticmap_upstream_requests_total", QByteArray(), static_cast<qint64>(upstream.upstream));
+    header(&ret, "qstaticmap_upstream_coalesced_total", "counter", "Fetches that joined a request already in flight.");
+    sample(&ret, "qstaticmap_upstream_coalesced_total", QByteArray(), static_cast<qint64>(upstream.coalesced));
+    header(&ret, "qstaticmap_upstream_errors_total", "counter", "Upstream requests that failed or returned no image.");
+    sample(&ret, "qstaticmap_upstream_errors_total", QByteArray(), static_cast<qint64>(upstream.errors));
+    header(&ret, "qstaticmap_upstream_skipped_total", "counter", "Fetches not sent upstream because the url failed recently.");
+    sample(&ret, "qstaticmap_upstream_skipped_total", QByteArray(), static_cast<qint64>(upstream.skipped));
+    return ret;
+}
@@ -0,0 +1,39 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QUrl>
+
+// Process wide counters and latency histograms, exposed in the Prometheus
+// text format together with the statistics of the caches.
+class Metrics
+{
+public:
+    // nanoseconds spent in each stage of a render
+    struct Timings {
+        qint64 parse = 0;
+        qint64 fetch = 0;
+        qint64 composite = 0;
+        qint64 encode = 0;
+    };
+
+    Metrics();
+    ~Metrics();
+
+    static Metrics *instance();
+
+    void renderStarted();
+    void renderFinished(const Timings &timings);
+    // logs the stage breakdown of requests slower than SLOW_REQUEST_MS
+    void requestFinished(const QUrl &url, bool cached, qint64 elapsed, const Timings &timings = Timings());
+    void addOutputBytes(qint64 bytes);
+
+    QByteArray exposition() const;
+
+private:
+    Q_DISABLE_COPY(Metrics)
+    class Private;
+    Private *d;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,188 @@
+#include "pathprocessor.h"
+
+#include <QtCore/QPair>
+
+namespace {
+
+inline qreal squaredDistance(const QPointF &a, const QPointF &b)
+{
+    const qreal dx = a.x() - b.x();
+    const qreal dy = a.y() - b.y();
+    return dx * dx + dy * dy;
+}
+
+inline qreal squaredSegmentDistance(const QPointF &p, const QPointF &a, const QPointF &b)
+{
+    const qreal dx = b.x() - a.x();
+    const qreal dy = b.y() - a.y();
+    const qreal length = dx * dx + dy * dy;
+    if (qFuzzyIsNull(length)) return squaredDistance(p, a);
+    qreal t = ((p.x() - a.x()) * dx + (p.y() - a.y()) * dy) / length;
+    t = qBound<qreal>(0, t, 1);
+    return squaredDistance(p, QPointF(a.x() + t * dx, a.y() + t * dy));
+}
+
+enum Edge { Left, Right, Top, Bottom };
+
+inline bool inside(const QPointF &p, Edge edge, const QRectF &rect)
+{
+    switch (edge) {
+    case Left: return p.x() >= rect.left();
+    case Right: return p.x() <= rect.right();
+    case Top: return p.y() >= rect.top();
+    case Bottom: return p.y() <= rect.bottom();
+    }
+    return false;
+}
+
+inline QPointF intersect(const QPointF &a, const QPointF &b, Edge edge, const QRectF &rect)
+{
+    qreal t = 0;
+    switch (edge) {
+    case Left: t = (rect.left() - a.x()) / (b.x() - a.x()); break;
+    case Right: t = (rect.right() - a.x()) / (b.x() - a.x()); break;
+    case Top: t = (rect.top() - a.y()) / (b.y() - a.y()); break;
+    case Bottom: t = (rect.bottom() - a.y()) / (b.y() - a.y()); break;
+    }
+    return QPointF(a.x() + t * (b.x() - a.x()), a.y() + t * (b.y() - a.y()));
+}
+
+// Liang-Barsky; reports whether either end point had to be moved
+bool clipSegment(QPointF *a, QPointF *b, const QRectF &rect, bool *startClipped, bool *endClipped)
+{
+    const qreal dx = b->x() - a->x();
+    const qreal dy = b->y() - a->y();
+    const qreal p[4] = { -dx, dx, -dy, dy };
+    const qreal q[4] = { a->x() - rect.left(), rect.right() - a->x(), a->y() - rect.top(), rect.bottom() - a->y() };
+    qreal t0 = 0;
+    qreal t1 = 1;
+    for (int i = 0; i < 4; i++) {
+        if (qFuzzyIsNull(p[i])) {
+            if (q[i] < 0) return false;
+            continue;
+        }
+        const qreal t = q[i] / p[i];
+        if (p[i] < 0) {
+            if (t > t1) return false;
+            if (t > t0) t0 = t;
+        } else {
+            if (t < t0) return false;
+            if (t < t1) t1 = t;
+        }
+    }
+    const QPointF origin = *a;
+    *startClipped = t0 > 0;
+    *endClipped = t1 < 1;
+    if (*startClipped) *a = QPointF(origin.x() + t0 * dx, origin.y() + t0 * dy);
+    if (*endClipped) *b = QPointF(origin.x() + t1 * dx, origin.y() + t1 * dy);
+    return true;
+}
+
+}
+
+// Sutherland-Hodgman, one pass per edge of the rectangle
+QPolygonF PathProcessor::clipPolygon(const QPolygonF &polygon, const QRectF &rect)
+{
+    if (rect.contains(polygon.boundingRect())) return polygon;
+
+    QPolygonF input = polygon;
+    QPolygonF output;
+    for (Edge edge : { Left, Right, Top, Bottom }) {
+        output.clear();
+        output.reserve(input.size() + 4);
+        for (int i = 0; i < input.size(); i++) {
+            const QPointF &current = input.at(i);
+            const QPointF &previous = input.at((i + input.size() - 1) % input.size());
+            const bool currentInside = inside(current, edge, rect);
+            if (currentInside != inside(previous, edge, rect)) {
+                output.append(intersect(previous, current, edge, rect));
+            }
+            if (currentInside) {
+                output.append(current);
+            }
+        }
+        if (output.isEmpty()) break;
+        input.swap(output);
+    }
+    return output.isEmpty() ? output : input;
+}
+
+QVector<QPolygonF> PathProcessor::clipPolyline(const QPolygonF &polyline, const QRectF &rect)
+{
+    QVector<QPolygonF> ret;
+    if (polyline.size() < 2) return ret;
+    if (rect.contains(polyline.boundingRect())) {
+        ret.append(polyline);
+        return ret;
+    }
+
+    QPolygonF run;
+    for (int i = 0; i + 1 < polyline.size(); i++) {
+        QPointF a = polyline.at(i);
+        QPointF b = polyline.at(i + 1);
+        bool startClipped = false;
+        bool endClipped = false;
+        if (!clipSegment(&a, &b, rect, &startClipped, &endClipped)) continue;
+        if (startClipped || run.isEmpty()) {
+            if (run.size() > 1) ret.append(run);
+            run.clear();
+            run.append(a);
+        }
+        run.append(b);
+        if (endClipped) {
+            ret.append(run);
+            run.clear();
+        }
+    }
+    if (run.size() > 1) ret.append(run);
+    return ret;
+}
+
+// Drops points closer than the tolerance to their predecessor, then runs
+// Douglas-Peucker with an explicit stack so that long tracks cannot overflow
+// the call stack.
+QPolygonF PathProcessor::simplify(const QPolygonF &polyline, qreal tolerance)
+{
+    if (polyline.size() < 3 || tolerance <= 0) return polyline;
+
+    const qreal squaredTolerance = tolerance * tolerance;
+    QPolygonF points;
+    points.reserve(polyline.size());
+    points.append(polyline.first());
+    for (int i = 1; i < polyline.size() - 1; i++) {
+        if (squaredDistance(polyline.at(i), points.last()) > squaredTolerance) {
+            points.append(polyline.at(i));
+        }
+    }
+    points.append(polyline.last());
+    if (points.size() < 3) return points;
+
+    QVector<bool> keep(points.size(), false);
+    keep[0] = true;
+    keep[points.size() - 1] = true;
+    QVector<QPair<int, int>> stack;
+    stack.append(qMakePair(0, points.size() - 1));
+    while (!stack.isEmpty()) {
+        const QPair<int, int> range = stack.takeLast();
+        qreal maximum = 0;
+        int index = -1;
+        for (int i = range.first + 1; i < range.second; i++) {
+            const qreal distance = squaredSegmentDistance(points.at(i), points.at(range.first), points.at(range.second));
+            if (distance > maximum) {
+                maximum = distance;
+                index = i;
+            }
+        }
+        if (index > -1 && maximum > squaredTolerance) {
+            keep[index] = true;
+            stack.append(qMakePair(range.first, index));
+            stack.append(qMakePair(index, range.second));
+        }
+    }
+
+    QPolygonF ret;
+    for (int i = 0; i < points.size(); i++) {
+        if (keep.at(i)) ret.append(points.at(i));
+    }
+    return ret;
+}
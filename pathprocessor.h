@@ -0,0 +1,19 @@
+#ifndef PATHPROCESSOR_H
+#define PATHPROCESSOR_H
+
+#include <QtCore/QRectF>
+#include <QtCore/QVector>
+#include <QtGui/QPolygonF>
+
+// Reduces paths to what is visible before they reach QPainter: clipping
+// against the output rectangle (plus a margin for the stroke) and
+// simplifying with a tolerance given in pixels.
+class PathProcessor
+{
+public:
+    static QPolygonF clipPolygon(const QPolygonF &polygon, const QRectF &rect);
+    static QVector<QPolygonF> clipPolyline(const QPolygonF &polyline, const QRectF &rect);
+    static QPolygonF simplify(const QPolygonF &polyline, qreal tolerance);
+};
+
+#endif // PATHPROCESSOR_H
@@ -0,0 +1,194 @@
+#include "prefork.h"
+#include "environment.h"
+#include "sharedtilecache.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QDebug>
+#include <QtCore/QHash>
+#include <QtCore/QThread>
+
+#include <QtNetwork/QTcpServer>
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Memory caches are per process; unless configured they get their share
+// of the default so that the total does not grow with the workers.
+void share(const char *name, int total, int workers)
+{
+    if (!qEnvironmentVariableIsSet(name)) {
+        qputenv(name, QByteArray::number(std::max(1, total / workers)));
+    }
+}
+
+#ifdef Q_OS_UNIX
+volatile sig_atomic_t stopping = 0;
+
+void stop(int)
+{
+    stopping = 1;
+}
+
+// 0 in the child
+pid_t spawn()
+{
+    const pid_t ret = fork();
+    if (ret == 0) {
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+    }
+    return ret;
+}
+#endif
+
+}
+
+int Prefork::workerCount(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        if (qstrcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            return QByteArray(argv[i + 1]).toInt();
+        }
+        if (qstrncmp(argv[i], "--workers=", 10) == 0) {
+            return QByteArray(argv[i] + 10).toInt();
+        }
+    }
+    return 0;
+}
+
+int Prefork::run(int workers)
+{
+#ifdef Q_OS_UNIX
+    share("RENDER_THREADS", QThread::idealThreadCount(), workers);
+    share("IMAGE_CACHE_SIZE", 256, workers);
+    share("BASE_LAYER_CACHE_SIZE", 64, workers);
+    share("RESPONSE_CACHE_SIZE", 64, workers);
+    // the workers share the directory, one of them evicts for all
+    qputenv("DISK_CACHE_SHARED", "1");
+    if (!SharedTileCache::create(environment("SHARED_CACHE_SIZE", 256) * Q_INT64_C(1024) * 1024,
+                                 environment("SHARED_CACHE_SLOT_SIZE", 64) * 1024)) {
+        qWarning() << "running without a shared tile cache";
+    }
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof action);
+    action.sa_handler = stop;
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGINT, &action, nullptr);
+
+    QHash<pid_t, qint64> children;
+    for (int i = 0; i < workers; i++) {
+        const pid_t pid = spawn();
+        if (pid == 0) return -1;
+        if (pid < 0) {
+            qWarning() << "could not fork:" << strerror(errno);
+            stopping = 1;
+            break;
+        }
+        children.insert(pid, QDateTime::currentMSecsSinceEpoch());
+    }
+
+    // A worker that dies right after it started, most likely because it
+    // could not listen, would die again; everything is shut down instead.
+    int ret = 0;
+    bool killed = false;
+    while (!children.isEmpty()) {
+        if (stopping && !killed) {
+            for (auto it = children.constBegin(); it != children.constEnd(); ++it) {
+                kill(it.key(), SIGTERM);
+            }
+            killed = true;
+        }
+        int status = 0;
+        const pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        const qint64 started = children.take(pid);
+        if (stopping) continue;
+        if (QDateTime::currentMSecsSinceEpoch() - started < 1000) {
+            qWarning() << "worker" << pid << "exited right after it started, stopping";
+            stopping = 1;
+            ret = 1;
+            continue;
+        }
+        qWarning() << "worker" << pid << "exited with" << status << ", restarting it";
+        const pid_t replacement = spawn();
+        if (replacement == 0) return -1;
+        if (replacement > 0) {
+            children.insert(replacement, QDateTime::currentMSecsSinceEpoch());
+        }
+    }
+    return ret;
+#else
+    Q_UNUSED(workers)
+    qWarning() << "--workers is not supported on this platform, running a single process";
+    return -1;
+#endif
+}
+
+QTcpServer *Prefork::listen(const QHostAddress &address, quint16 port, QObject *parent)
+{
+#ifdef Q_OS_UNIX
+    const bool ipv6 = address.protocol() == QAbstractSocket::IPv6Protocol;
+    const int fd = socket(ipv6 ? AF_INET6 : AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return nullptr;
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof on) < 0) {
+        qWarning() << "SO_REUSEPORT:" << strerror(errno);
+        close(fd);
+        return nullptr;
+    }
+
+    sockaddr_storage storage;
+    std::memset(&storage, 0, sizeof storage);
+    socklen_t length;
+    if (ipv6) {
+        sockaddr_in6 *in6 = reinterpret_cast<sockaddr_in6 *>(&storage);
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        const Q_IPV6ADDR ip = address.toIPv6Address();
+        std::memcpy(&in6->sin6_addr, &ip, sizeof ip);
+        length = sizeof *in6;
+    } else {
+        sockaddr_in *in = reinterpret_cast<sockaddr_in *>(&storage);
+        in->sin_family = AF_INET;
+        in->sin_port = htons(port);
+        in->sin_addr.s_addr = htonl(address.toIPv4Address());
+        length = sizeof *in;
+    }
+    if (bind(fd, reinterpret_cast<sockaddr *>(&storage), length) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+        qWarning() << "could not listen on" << address << port << ":" << strerror(errno);
+        close(fd);
+        return nullptr;
+    }
+
+    QTcpServer *ret = new QTcpServer(parent);
+    if (!ret->setSocketDescriptor(fd)) {
+        delete ret;
+        close(fd);
+        return nullptr;
+    }
+    return ret;
+#else
+    QTcpServer *ret = new QTcpServer(parent);
+    if (!ret->listen(address, port)) {
+        delete ret;
+        return nullptr;
+    }
+    return ret;
+#endif
+}
@@ -0,0 +1,27 @@
+#ifndef PREFORK_H
+#define PREFORK_H
+
+#include <QtNetwork/QHostAddress>
+
+class QObject;
+class QTcpServer;
+
+// A supervisor process that forks the workers serving requests and forks
+// them again when they die. Every worker opens its own listen socket on
+// the same address with SO_REUSEPORT and the kernel spreads connections
+// over them; tiles are shared through the SharedTileCache.
+class Prefork
+{
+public:
+    // --workers N, read before QGuiApplication exists since forking has
+    // to happen before any thread is started
+    static int workerCount(int argc, char *argv[]);
+
+    // Returns -1 in the workers, which go on to serve, and the exit code
+    // in the supervisor once the workers are gone.
+    static int run(int workers);
+
+    static QTcpServer *listen(const QHostAddress &address, quint16 port, QObject *parent = nullptr);
+};
+
+#endif // PREFORK_H
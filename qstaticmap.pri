@@ -0,0 +1,50 @@
+# The map rendering code, shared by the server and the benchmarks
+
+QT += httpserver concurrent sql
+
+INCLUDEPATH += $$PWD
+
+HEADERS += \
+    $$PWD/baselayercache.h \
+    $$PWD/coordinate.h \
+    $$PWD/diskcache.h \
+    $$PWD/environment.h \
+    $$PWD/imageencoder.h \
+    $$PWD/imagecache.h \
+    $$PWD/imagefetcher.h \
+    $$PWD/labelcache.h \
+    $$PWD/markeratlas.h \
+    $$PWD/metrics.h \
+    $$PWD/pathprocessor.h \
+    $$PWD/prefork.h \
+    $$PWD/responsecache.h \
+    $$PWD/sharedtilecache.h \
+    $$PWD/staticmap.h \
+    $$PWD/tilemath.h \
+    $$PWD/tileseeder.h \
+    $$PWD/tilesource.h \
+    $$PWD/urlqueryparser.h \
+    $$PWD/viewport.h
+
+SOURCES += \
+    $$PWD/baselayercache.cpp \
+    $$PWD/coordinate.cpp \
+    $$PWD/diskcache.cpp \
+    $$PWD/imageencoder.cpp \
+    $$PWD/imagecache.cpp \
+    $$PWD/imagefetcher.cpp \
+    $$PWD/labelcache.cpp \
+    $$PWD/markeratlas.cpp \
+    $$PWD/metrics.cpp \
+    $$PWD/pathprocessor.cpp \
+    $$PWD/prefork.cpp \
+    $$PWD/responsecache.cpp \
+    $$PWD/sharedtilecache.cpp \
+    $$PWD/staticmap.cpp \
+    $$PWD/tileseeder.cpp \
+    $$PWD/tilesource.cpp \
+    $$PWD/urlqueryparser.cpp \
+    $$PWD/viewport.cpp
+
+RESOURCES += \
+    $$PWD/fonts.qrc
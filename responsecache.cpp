@@ -0,0 +1,91 @@
+#include "responsecache.h"
+#include "environment.h"
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QCache>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QMutex>
+
+#include <algorithm>
+#include <limits>
+
+class ResponseCache::Private
+{
+public:
+    Private(qint64 maximumBytes);
+
+    mutable QMutex mutex;
+    QCache<QByteArray, Entry> cache;
+    mutable QAtomicInteger<quint64> hits;
+    mutable QAtomicInteger<quint64> misses;
+};
+
+ResponseCache::Private::Private(qint64 maximumBytes)
+    : hits(0)
+    , misses(0)
+{
+    cache.setMaxCost(static_cast<int>(std::min<qint64>(maximumBytes / 1024, std::numeric_limits<int>::max())));
+}
+
+ResponseCache::ResponseCache(qint64 maximumBytes)
+    : d(new Private(maximumBytes))
+{
+}
+
+ResponseCache::~ResponseCache()
+{
+    delete d;
+}
+
+ResponseCache *ResponseCache::instance()
+{
+    static ResponseCache cache(environment("RESPONSE_CACHE_SIZE", 64) * Q_INT64_C(1024) * 1024);
+    return &cache;
+}
+
+QByteArray ResponseCache::etag(const QByteArray &data)
+{
+    return '"' + QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex() + '"';
+}
+
+bool ResponseCache::find(const QByteArray &key, Entry *entry) const
+{
+    QMutexLocker locker(&d->mutex);
+    const Entry *cached = d->cache.object(key);
+    if (!cached) {
+        d->misses.fetchAndAddRelaxed(1);
+        return false;
+    }
+    d->hits.fetchAndAddRelaxed(1);
+    *entry = *cached;
+    return true;
+}
+
+ResponseCache::Entry ResponseCache::insert(const QByteArray &key, const QByteArray &mimeType, const QByteArray &data)
+{
+    Entry entry;
+    entry.mimeType = mimeType;
+    entry.data = data;
+    entry.etag = etag(data);
+
+    QMutexLocker locker(&d->mutex);
+    d->cache.insert(key, new Entry(entry), std::max(1, (data.size() + key.size()) / 1024));
+    return entry;
+}
+
+void ResponseCache::clear()
+{
+    QMutexLocker locker(&d->mutex);
+    d->cache.clear();
+}
+
+ResponseCache::Statistics ResponseCache::statistics() const
+{
+    Statistics ret;
+    ret.hits = d->hits.loadAcquire();
+    ret.misses = d->misses.loadAcquire();
+    QMutexLocker locker(&d->mutex);
+    ret.bytes = d->cache.totalCost() * Q_INT64_C(1024);
+    ret.count = d->cache.count();
+    return ret;
+}
@@ -0,0 +1,40 @@
+#ifndef RESPONSECACHE_H
+#define RESPONSECACHE_H
+
+#include <QtCore/QByteArray>
+
+class ResponseCache
+{
+public:
+    // an entry without an etag was not cached and must not be by others
+    struct Entry {
+        QByteArray mimeType;
+        QByteArray data;
+        QByteArray etag;
+    };
+    struct Statistics {
+        quint64 hits;
+        quint64 misses;
+        qint64 bytes;
+        int count;
+    };
+
+    explicit ResponseCache(qint64 maximumBytes);
+    ~ResponseCache();
+
+    static ResponseCache *instance();
+    static QByteArray etag(const QByteArray &data);
+
+    bool find(const QByteArray &key, Entry *entry) const;
+    Entry insert(const QByteArray &key, const QByteArray &mimeType, const QByteArray &data);
+    void clear();
+
+    Statistics statistics() const;
+
+private:
+    Q_DISABLE_COPY(ResponseCache)
+    class Private;
+    Private *d;
+};
+
+#endif // RESPONSECACHE_H
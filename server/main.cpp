@@ -0,0 +1,645 @@
+#include "staticmap.h"
+#include "environment.h"
+#include "metrics.h"
+#include "prefork.h"
+#include "urlqueryparser.h"
+#include "responsecache.h"
+#include "imageencoder.h"
+#include "tileseeder.h"
+#include "tilesource.h"
+
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QDeadlineTimer>
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QThreadPool>
+#include <QtCore/QTimer>
+#include <QtCore/QUrlQuery>
+
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <QtGui/QGuiApplication>
+#include <QtGui/QImage>
+#include <QtGui/QFontDatabase>
+
+#include <QtHttpServer/QHttpServer>
+#include <QtHttpServer/QHttpServerRequest>
+#include <QtHttpServer/QHttpServerResponder>
+#include <QtHttpServer/QHttpServerResponse>
+
+#include <QtNetwork/QTcpServer>
+
+#include <algorithm>
+#include <functional>
+
+// Printed to round-trip precision: any coarser and two coordinates a pixel
+// apart at deep zoom levels would share a key and an etag.
+QString canonicalCoordinate(const QString &value)
+{
+    bool ok1, ok2;
+    double lat = value.section(QLatin1Char(','), 0, 0).toDouble(&ok1);
+    double lng = value.section(QLatin1Char(','), 1, 1).toDouble(&ok2);
+    if (!ok1 || !ok2) return value;
+    return QString::number(lat, 'g', 17) + QLatin1Char(',') + QString::number(lng, 'g', 17);
+}
+
+QString canonicalColor(const QString &value)
+{
+    bool ok;
+    uint rgba = value.toUInt(&ok, 16);
+    if (!ok) return value;
+    return QString::number(rgba, 16).rightJustified(8, QLatin1Char('0'));
+}
+
+// Two queries that render the same map produce the same key: parameters are
+// sorted by name (keeping the order of repeated ones, which is the drawing
+// order), coordinates and colors are normalized.
+QByteArray canonicalQuery(const QUrlQuery &query)
+{
+    QList<QPair<QString, QString>> items = query.queryItems(QUrl::FullyDecoded);
+    for (auto &item : items) {
+        const QString &key = item.first;
+        QString &value = item.second;
+        if (key == QStringLiteral("center")) {
+            value = canonicalCoordinate(value);
+        } else if (key == QStringLiteral("path") || key == QStringLiteral("images") || key == QStringLiteral("markers") || key == QStringLiteral("labels")) {
+            // an encoded polyline runs to the end and may contain '|'
+            int encoded = value.startsWith(QStringLiteral("enc:")) ? 0 : value.indexOf(QStringLiteral("|enc:"));
+            const QString polyline = encoded < 0 ? QString() : value.mid(encoded);
+            if (encoded >= 0) value.truncate(encoded);
+            QStringList tokens = value.split(QLatin1Char('|'));
+            for (QString &token : tokens) {
+                int colon = token.indexOf(QLatin1Char(':'));
+                if (colon > -1) {
+                    QString name = token.left(colon);
+                    // marker colors are 24 or 32 bit, normalizing would lose which
+                    if ((name == QStringLiteral("color") || name == QStringLiteral("fillcolor")) && key != QStringLiteral("markers")) {
+                        token = name + QLatin1Char(':') + canonicalColor(token.mid(colon + 1));
+                    }
+                } else if (token.contains(QLatin1Char(','))) {
+                    token = canonicalCoordinate(token);
+                }
+            }
+            value = tokens.join(QLatin1Char('|')) + polyline;
+        } else {
+            value = value.trimmed();
+        }
+    }
+    std::stable_sort(items.begin(), items.end(), [](const QPair<QString, QString> &a, const QPair<QString, QString> &b) {
+        return a.first < b.first;
+    });
+    QUrlQuery canonical;
+    canonical.setQueryItems(items);
+    return canonical.toString(QUrl::FullyEncoded).toUtf8();
+}
+
+void refuse(QHttpServerResponder &responder, QHttpServerResponder::StatusCode status, const QByteArray &message)
+{
+    QHttpServerResponse response(QByteArrayLiteral("text/plain"), message + '\n', status);
+    if (status == QHttpServerResponder::StatusCode::ServiceUnavailable) {
+        response.addHeader(QByteArrayLiteral("Retry-After"), QByteArrayLiteral("1"));
+    }
+    responder.sendResponse(response);
+}
+
+// A map missing tiles or icons has no etag and is sent uncacheable, so that
+// it is not kept anywhere once the upstream has recovered.
+void respond(QHttpServerResponder &responder, const ResponseCache::Entry &entry, const QByteArray &ifNoneMatch)
+{
+    static const QByteArray cacheControl = QByteArrayLiteral("public, max-age=")
+            + QByteArray::number(environment("RESPONSE_MAX_AGE", 86400));
+
+    if (entry.data.isEmpty()) {
+        refuse(responder, QHttpServerResponder::StatusCode::InternalServerError, QByteArrayLiteral("encoding failed"));
+        return;
+    }
+
+    if (entry.etag.isEmpty()) {
+        QHttpServerResponse response(entry.mimeType, entry.data);
+        response.addHeader(QByteArrayLiteral("Cache-Control"), QByteArrayLiteral("no-store"));
+        responder.sendResponse(response);
+        Metrics::instance()->addOutputBytes(entry.data.size());
+        return;
+    }
+
+    bool notModified = false;
+    for (const QByteArray &tag : ifNoneMatch.split(',')) {
+        QByteArray value = tag.trimmed();
+        if (value == "*" || value == entry.etag || value == "W/" + entry.etag) {
+            notModified = true;
+            break;
+        }
+    }
+
+    if (notModified) {
+        QHttpServerResponse response(QHttpServerResponder::StatusCode::NotModified);
+        response.addHeader(QByteArrayLiteral("ETag"), entry.etag);
+        response.addHeader(QByteArrayLiteral("Cache-Control"), cacheControl);
+        responder.sendResponse(response);
+    } else {
+        QHttpServerResponse response(entry.mimeType, entry.data);
+        response.addHeader(QByteArrayLiteral("ETag"), entry.etag);
+        response.addHeader(QByteArrayLiteral("Cache-Control"), cacheControl);
+        responder.sendResponse(response);
+        Metrics::instance()->addOutputBytes(entry.data.size());
+    }
+}
+
+void parseQuery(const QUrlQuery &query, StaticMap *map, ImageEncoder *encoder)
+{
+    for (const auto &item : query.queryItems(QUrl::FullyDecoded)) {
+        QString key = item.first;
+        QString value = item.second;
+        if (key == QStringLiteral("size")) {
+            QSize size;
+            if (!UrlQueryParser::parseSize(value, &size)) break;
+            map->setSize(size);
+        } else if (key == QStringLiteral("center")) {
+            Coordinate center;
+            if (!UrlQueryParser::parseCoordinate(value, &center)) break;
+            map->setCenter(center);
+        } else if (key == QStringLiteral("zoom")) {
+            double z;
+            if (!UrlQueryParser::parseDouble(value, &z)) break;
+            map->setZoom(qBound<qreal>(0, z, 24));
+        } else if (key == QStringLiteral("scale")) {
+            bool ok;
+            int scale = value.toInt(&ok);
+            if (!ok || scale < 1 || scale > 3) break;
+            map->setScale(scale);
+        } else if (key == QStringLiteral("format")) {
+            if (!encoder->setFormat(value)) {
+                qWarning() << key << value << "not supported";
+            }
+        } else if (key == QStringLiteral("quality")) {
+            bool ok;
+            int quality = value.toInt(&ok);
+            if (!ok) break;
+            encoder->setQuality(quality);
+        } else if (key == QStringLiteral("path")) {
+            StaticMap::Path path;
+            UrlQueryParser::parse(value, [&path] (QStringView key, QStringView value) {
+                if (key == QLatin1String("color")) {
+                    uint rgba = value.toString().toUInt(nullptr, 16);
+                    path.border.color = QColor::fromRgba((rgba >> 8) | (rgba & 0xff) << 24);
+                } else if (key == QLatin1String("weight")) {
+                    path.border.width = value.toString().toInt();
+                } else if (key == QLatin1String("fillcolor")) {
+                    uint rgba = value.toString().toUInt(nullptr, 16);
+                    path.color = QColor::fromRgba((rgba >> 8) | (rgba & 0xff) << 24);
+                } else if (key == QLatin1String("closed")) {
+                    path.closed = value != QLatin1String("false");
+                } else {
+                    qDebug() << key << value << "not suppored";
+                }
+            }, [&path](const Coordinate &coordinate) {
+                path.coordinates.append(coordinate);
+            });
+            map->addPath(path);
+        } else if (key == QStringLiteral("images")) {
+            StaticMap::Image image;
+            UrlQueryParser::parse(value, [&image] (QStringView key, QStringView value) {
+                if (key == QLatin1String("icon")) {
+                    image.url = QUrl(value.toString());
+                } else {
+                    qDebug() << key << value << "not suppored";
+                }
+            }, [&image, map](const Coordinate &coordinate) {
+                image.coordinate = coordinate;
+                map->addImage(image);
+            });
+        } else if (key == QStringLiteral("markers")) {
+            StaticMap::Image image;
+            UrlQueryParser::parse(value, [&image] (QStringView key, QStringView value) {
+                if (key == QLatin1String("color")) {
+                    // 0xRRGGBB, 0xRRGGBBAA or a color name
+                    const QString color = value.toString();
+                    bool ok;
+                    uint rgba = color.toUInt(&ok, 16);
+                    if (!ok) {
+                        image.color = QColor(color);
+                    } else if (color.length() - (color.startsWith(QStringLiteral("0x")) ? 2 : 0) > 6) {
+                        image.color = QColor::fromRgba((rgba >> 8) | (rgba & 0xff) << 24);
+                    } else {
+                        image.color = QColor::fromRgb(rgba);
+                    }
+                } else if (key == QLatin1String("size")) {
+                    if (value == QLatin1String("tiny")) {
+                        image.size = MarkerAtlas::Tiny;
+                    } else if (value == QLatin1String("small")) {
+                        image.size = MarkerAtlas::Small;
+                    } else {
+                        image.size = MarkerAtlas::Mid;
+                    }
+                } else if (key == QLatin1String("label")) {
+                    image.label = value.isEmpty() ? QChar() : value.front().toUpper();
+                } else {
+                    qDebug() << key << value << "not suppored";
+                }
+            }, [&image, map](const Coordinate &coordinate) {
+                image.coordinate = coordinate;
+                map->addImage(image);
+            });
+        } else if (key == QStringLiteral("labels")) {
+            StaticMap::Text text;
+            UrlQueryParser::parse(value, [&text] (QStringView key, QStringView value) {
+                if (key == QLatin1String("text")) {
+                    text.text = value.toString();
+                } else {
+                    qDebug() << key << value << "not suppored";
+                }
+            }, [&text, map](const Coordinate &coordinate) {
+                text.coordinate = coordinate;
+                map->addText(text);
+            });
+        } else {
+            qWarning() << key << "not supported";
+        }
+    }
+}
+
+int seed(const QCommandLineParser &parser)
+{
+    TileSeeder seeder;
+    for (const QString &value : parser.values(QStringLiteral("bbox"))) {
+        const QStringList corners = value.split(QLatin1Char(','));
+        bool ok = corners.length() == 4;
+        double lat1 = ok ? corners[0].toDouble(&ok) : 0;
+        double lng1 = ok ? corners[1].toDouble(&ok) : 0;
+        double lat2 = ok ? corners[2].toDouble(&ok) : 0;
+        double lng2 = ok ? corners[3].toDouble(&ok) : 0;
+        if (!ok) {
+            qWarning() << "invalid bbox" << value;
+            return 1;
+        }
+        seeder.addArea(Coordinate(std::max(lat1, lat2), std::min(lng1, lng2)),
+                       Coordinate(std::min(lat1, lat2), std::max(lng1, lng2)));
+    }
+    for (const QString &value : parser.values(QStringLiteral("view"))) {
+        const QStringList items = value.split(QLatin1Char(','));
+        const QStringList size = items.length() == 3 ? items[2].split(QLatin1Char('x')) : QStringList();
+        bool ok = size.length() == 2;
+        double lat = ok ? items[0].toDouble(&ok) : 0;
+        double lng = ok ? items[1].toDouble(&ok) : 0;
+        int w = ok ? size[0].toInt(&ok) : 0;
+        int h = ok ? size[1].toInt(&ok) : 0;
+        if (!ok) {
+            qWarning() << "invalid view" << value;
+            return 1;
+        }
+        seeder.addView(Coordinate(lat, lng), QSize(w, h));
+    }
+
+    // there are no tiles past the last level of the source
+    const int deepestZoom = std::max(0, std::min(environment("TILE_MAX_ZOOM", 19), 30));
+    const QStringList zoom = parser.value(QStringLiteral("zoom")).split(QLatin1Char('-'));
+    bool ok1, ok2;
+    int minimumZoom = zoom.first().toInt(&ok1);
+    int maximumZoom = zoom.last().toInt(&ok2);
+    if (!ok1 || !ok2 || zoom.length() > 2
+            || minimumZoom < 0 || minimumZoom > deepestZoom || maximumZoom < 0 || maximumZoom > deepestZoom) {
+        qWarning() << "invalid zoom" << parser.value(QStringLiteral("zoom"));
+        return 1;
+    }
+    seeder.setZoomRange(minimumZoom, maximumZoom);
+    seeder.setRate(parser.value(QStringLiteral("rate")).toInt());
+    seeder.setMaximumConnectionsPerHost(std::max(1, environment("MAX_CONNECTIONS_PER_HOST", 6)));
+
+    QObject::connect(&seeder, &TileSeeder::finished, qApp, &QCoreApplication::quit);
+    QTimer::singleShot(0, &seeder, &TileSeeder::start);
+    return qApp->exec();
+}
+
+// Answers from the response cache right away, otherwise the map is parsed
+// here on the event loop, rendered and encoded on the pool and done is
+// called back on the event loop, with an entry without data if the map could
+// not be encoded. Requests over the limits or arriving while the render
+// queue is full are refused: done is not called, a status other than Ok is
+// returned along with a message.
+QHttpServerResponder::StatusCode renderQuery(QThreadPool *pool, const QUrlQuery &query, const QUrl &url, const std::function<void(const ResponseCache::Entry &)> &done, QByteArray *error, int maximumLength = -1)
+{
+    static const int maximumQueryLength = environment("MAX_QUERY_LENGTH", 64 * 1024);
+    static const qint64 maximumPixels = environment("MAX_PIXELS", 2048 * 2048);
+    static const int maximumTiles = environment("MAX_TILES", 256);
+    static const int maximumVertices = environment("MAX_VERTICES", 100000);
+    static const int maximumPending = environment("MAX_PENDING_RENDERS", pool->maxThreadCount() * 4);
+    static const int timeout = environment("REQUEST_TIMEOUT_MS", 10000);
+    // only touched on the event loop
+    static int pending = 0;
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    const QString queryString = query.toString(QUrl::FullyEncoded);
+    if (queryString.size() > (maximumLength < 0 ? maximumQueryLength : maximumLength)) {
+        *error = QByteArrayLiteral("query too long");
+        return QHttpServerResponder::StatusCode::UriTooLong;
+    }
+    const QByteArray key = canonicalQuery(query);
+    ResponseCache::Entry entry;
+    if (ResponseCache::instance()->find(key, &entry)) {
+        done(entry);
+        Metrics::instance()->requestFinished(url, true, elapsed.nsecsElapsed());
+        return QHttpServerResponder::StatusCode::Ok;
+    }
+    if (pending >= maximumPending) {
+        *error = QByteArrayLiteral("too many renders queued");
+        return QHttpServerResponder::StatusCode::ServiceUnavailable;
+    }
+
+    QSharedPointer<StaticMap> map(new StaticMap, &QObject::deleteLater);
+    map->setZoom(16);
+    ImageEncoder encoder;
+    parseQuery(query, map.data(), &encoder);
+    const QSize size = map->size() * map->scale();
+    if (static_cast<qint64>(size.width()) * size.height() > maximumPixels || size.isEmpty()) {
+        *error = QByteArrayLiteral("size out of range");
+        return QHttpServerResponder::StatusCode::BadRequest;
+    }
+    if (map->tileCount() > maximumTiles) {
+        *error = QByteArrayLiteral("too many tiles");
+        return QHttpServerResponder::StatusCode::BadRequest;
+    }
+    if (map->vertexCount() > maximumVertices) {
+        *error = QByteArrayLiteral("too many path vertices");
+        return QHttpServerResponder::StatusCode::BadRequest;
+    }
+    if (timeout > 0) {
+        map->setDeadline(QDeadlineTimer(timeout));
+    }
+    Metrics::Timings timings;
+    timings.parse = elapsed.nsecsElapsed();
+
+    pending++;
+    Metrics::instance()->renderStarted();
+    QtConcurrent::run(pool, [map, encoder, key, url, elapsed, timings, done]() mutable {
+        StaticMap::Timings renderTimings;
+        const QImage image = map->render(&renderTimings);
+        timings.fetch = renderTimings.fetch;
+        timings.composite = renderTimings.composite;
+        QElapsedTimer encoding;
+        encoding.start();
+        QByteArray data;
+        const bool encoded = encoder.encode(image, &data);
+        timings.encode = encoding.nsecsElapsed();
+        Metrics::instance()->renderFinished(timings);
+
+        ResponseCache::Entry entry;
+        if (!encoded) {
+            qWarning() << "could not encode" << url;
+        } else if (renderTimings.complete) {
+            entry = ResponseCache::instance()->insert(key, encoder.mimeType(), data);
+        } else {
+            entry.mimeType = encoder.mimeType();
+            entry.data = data;
+        }
+        QMetaObject::invokeMethod(qApp, [entry, url, elapsed, timings, done]() {
+            pending--;
+            done(entry);
+            Metrics::instance()->requestFinished(url, false, elapsed.nsecsElapsed(), timings);
+        }, Qt::QueuedConnection);
+    });
+    return QHttpServerResponder::StatusCode::Ok;
+}
+
+// A spec is either a query string or an object of parameters, whose values
+// are strings, numbers or arrays of them for repeated parameters.
+bool batchQuery(const QJsonValue &spec, QUrlQuery *query)
+{
+    if (spec.isString()) {
+        *query = QUrlQuery(spec.toString());
+        return true;
+    }
+    if (!spec.isObject()) return false;
+    const QJsonObject object = spec.toObject();
+    for (auto it = object.constBegin(); it != object.constEnd(); ++it) {
+        const QJsonArray values = it.value().isArray() ? it.value().toArray() : QJsonArray({ it.value() });
+        for (const QJsonValue &value : values) {
+            if (!value.isString() && !value.isDouble() && !value.isBool()) return false;
+            query->addQueryItem(it.key(), value.toVariant().toString());
+        }
+    }
+    return true;
+}
+
+void writeChunk(QHttpServerResponder *responder, const QByteArray &data)
+{
+    responder->writeBody(QByteArray::number(data.size(), 16) + "\r\n" + data + "\r\n");
+}
+
+struct BatchStream {
+    explicit BatchStream(QHttpServerResponder &&responder) : responder(std::move(responder)) {}
+
+    QHttpServerResponder responder;
+    QByteArray boundary;
+    QUrl url;
+    QVector<QUrlQuery> queries;
+    int next = 0;
+    int inFlight = 0;
+    bool pumping = false;
+    bool finished = false;
+};
+
+void writePart(BatchStream *stream, int index, const QByteArray &headers, const QByteArray &data)
+{
+    QByteArray part = "--" + stream->boundary + "\r\n" + headers;
+    part += "Content-ID: <" + QByteArray::number(index) + ">\r\n";
+    part += "Content-Length: " + QByteArray::number(data.size()) + "\r\n\r\n";
+    writeChunk(&stream->responder, part + data + "\r\n");
+}
+
+// Hands maps to renderQuery() until the render queue is full, then goes on
+// when one of them finishes, or shortly when none of them is in flight.
+// Maps refused for other reasons get a text part with the status they
+// would have had on their own.
+void pumpBatch(QThreadPool *pool, const QSharedPointer<BatchStream> &stream)
+{
+    stream->pumping = true;
+    while (stream->next < stream->queries.size()) {
+        const int i = stream->next++;
+        QUrl url = stream->url;
+        url.setQuery(stream->queries.at(i));
+        QByteArray error;
+        stream->inFlight++;
+        const auto status = renderQuery(pool, stream->queries.at(i), url, [pool, stream, i](const ResponseCache::Entry &entry) {
+            stream->inFlight--;
+            if (entry.data.isEmpty()) {
+                writePart(stream.data(), i, "Content-Type: text/plain\r\nX-Status: 500\r\n", QByteArrayLiteral("encoding failed"));
+            } else {
+                const QByteArray etag = entry.etag.isEmpty() ? QByteArray() : "ETag: " + entry.etag + "\r\n";
+                writePart(stream.data(), i, "Content-Type: " + entry.mimeType + "\r\n" + etag, entry.data);
+                Metrics::instance()->addOutputBytes(entry.data.size());
+            }
+            if (!stream->pumping) {
+                pumpBatch(pool, stream);
+            }
+        }, &error);
+        if (status == QHttpServerResponder::StatusCode::Ok) continue;
+
+        stream->inFlight--;
+        if (status == QHttpServerResponder::StatusCode::ServiceUnavailable) {
+            stream->next--;
+            if (stream->inFlight == 0) {
+                QTimer::singleShot(50, qApp, [pool, stream]() { pumpBatch(pool, stream); });
+            }
+            break;
+        }
+        writePart(stream.data(), i, "Content-Type: text/plain\r\nX-Status: " + QByteArray::number(static_cast<int>(status)) + "\r\n", error);
+    }
+    stream->pumping = false;
+
+    if (!stream->finished && stream->next == stream->queries.size() && stream->inFlight == 0) {
+        stream->finished = true;
+        writeChunk(&stream->responder, "--" + stream->boundary + "--\r\n");
+        stream->responder.writeBody(QByteArrayLiteral("0\r\n\r\n"));
+    }
+}
+
+// POST /batch takes a JSON array of map specs and streams the maps back as
+// multipart/mixed in the order they finish. Every part carries the index of
+// its spec in Content-ID. The maps render concurrently on the pool, so tiles
+// they share are fetched once.
+void batch(QThreadPool *pool, const QHttpServerRequest &request, QHttpServerResponder &&responder)
+{
+    static const int maximumMaps = environment("BATCH_MAX_MAPS", 1000);
+
+    if (request.method() != QHttpServerRequest::Method::Post) {
+        responder.write(QHttpServerResponder::StatusCode::MethodNotAllowed);
+        return;
+    }
+    QJsonParseError error;
+    const QJsonDocument document = QJsonDocument::fromJson(request.body(), &error);
+    if (error.error != QJsonParseError::NoError || !document.isArray()) {
+        refuse(responder, QHttpServerResponder::StatusCode::BadRequest, QByteArrayLiteral("expected a JSON array of map specs"));
+        return;
+    }
+    const QJsonArray specs = document.array();
+    if (specs.size() > maximumMaps) {
+        refuse(responder, QHttpServerResponder::StatusCode::PayloadTooLarge, QByteArrayLiteral("too many maps"));
+        return;
+    }
+    QVector<QUrlQuery> queries(specs.size());
+    for (int i = 0; i < specs.size(); i++) {
+        if (!batchQuery(specs.at(i), &queries[i])) {
+            refuse(responder, QHttpServerResponder::StatusCode::BadRequest, QByteArrayLiteral("invalid map spec ") + QByteArray::number(i));
+            return;
+        }
+    }
+
+    QSharedPointer<BatchStream> stream(new BatchStream(std::move(responder)));
+    stream->boundary = QByteArrayLiteral("qstaticmap-") + QByteArray::number(QRandomGenerator::global()->generate64(), 16);
+    stream->url = request.url();
+    stream->queries = queries;
+    stream->responder.writeStatusLine(QHttpServerResponder::StatusCode::Ok);
+    stream->responder.writeHeader(QByteArrayLiteral("Content-Type"), QByteArrayLiteral("multipart/mixed; boundary=") + stream->boundary);
+    stream->responder.writeHeader(QByteArrayLiteral("Transfer-Encoding"), QByteArrayLiteral("chunked"));
+    pumpBatch(pool, stream);
+}
+
+int main(int argc, char *argv[])
+{
+    const int workers = Prefork::workerCount(argc, argv);
+    if (workers > 0) {
+        const int ret = Prefork::run(workers);
+        if (ret >= 0) return ret;
+    }
+
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOptions({
+        { QStringLiteral("seed"), QCoreApplication::translate("main", "Fill the tile cache and exit.") },
+        { QStringLiteral("bbox"), QCoreApplication::translate("main", "Area to seed, two corners (repeatable)."), QStringLiteral("lat1,lng1,lat2,lng2") },
+        { QStringLiteral("view"), QCoreApplication::translate("main", "Map to seed, center and size (repeatable)."), QStringLiteral("lat,lng,WxH") },
+        { QStringLiteral("zoom"), QCoreApplication::translate("main", "Zoom levels to seed."), QStringLiteral("min-max"), QStringLiteral("0-16") },
+        { QStringLiteral("rate"), QCoreApplication::translate("main", "Maximum tile requests per second while seeding."), QStringLiteral("rate"), QStringLiteral("20") },
+        { QStringLiteral("build-pack"), QCoreApplication::translate("main", "Pack the tiles of --tiles into a pack file and exit."), QStringLiteral("file") },
+        { QStringLiteral("tiles"), QCoreApplication::translate("main", "Tile directory laid out as {z}/{x}/{y}.png."), QStringLiteral("directory") },
+        { QStringLiteral("listen"), QCoreApplication::translate("main", "Address to serve maps on."), QStringLiteral("address"), QStringLiteral("127.0.0.1") },
+        { QStringLiteral("port"), QCoreApplication::translate("main", "Port to serve maps on."), QStringLiteral("port"), QStringLiteral("9100") },
+        { QStringLiteral("workers"), QCoreApplication::translate("main", "Serve from this many processes sharing the port and a tile cache."), QStringLiteral("count"), QStringLiteral("0") },
+    });
+    parser.process(app);
+    if (parser.isSet(QStringLiteral("build-pack"))) {
+        if (!parser.isSet(QStringLiteral("tiles"))) {
+            qWarning() << "--build-pack needs --tiles";
+            return 1;
+        }
+        return TileSource::writePack(parser.value(QStringLiteral("tiles")), parser.value(QStringLiteral("build-pack"))) ? 0 : 1;
+    }
+    if (parser.isSet(QStringLiteral("seed"))) {
+        return seed(parser);
+    }
+
+    QFontDatabase::addApplicationFont(":/fonts/OpenSans-Regular.ttf");
+
+    QThreadPool renderPool;
+    renderPool.setMaxThreadCount(std::max(1, environment("RENDER_THREADS", renderPool.maxThreadCount())));
+    if (!QFontDatabase::supportsThreadedFontRendering()) {
+        qWarning() << "threaded font rendering is not supported, rendering on a single thread";
+        renderPool.setMaxThreadCount(1);
+    }
+
+    QHttpServer server;
+    server.route("/metrics", [] (const QHttpServerRequest &, QHttpServerResponder &&responder) {
+        responder.sendResponse(QHttpServerResponse(QByteArrayLiteral("text/plain; version=0.0.4"), Metrics::instance()->exposition()));
+    });
+    server.route("/batch", [&renderPool] (const QHttpServerRequest &request, QHttpServerResponder &&responder) {
+        batch(&renderPool, request, std::move(responder));
+    });
+    // a POST takes the parameters form encoded in the body as well, for maps
+    // that do not fit in a url
+    server.route("/", [&renderPool] (const QHttpServerRequest &request, QHttpServerResponder &&responder) {
+        static const int maximumBodyLength = environment("MAX_BODY_LENGTH", 4 * 1024 * 1024);
+        qDebug() << request.url();
+        QUrlQuery query = request.query();
+        int maximumLength = -1;
+        if (request.method() == QHttpServerRequest::Method::Post) {
+            QByteArray body = request.body();
+            if (body.size() > maximumBodyLength) {
+                refuse(responder, QHttpServerResponder::StatusCode::PayloadTooLarge, QByteArrayLiteral("body too long"));
+                return;
+            }
+            const QUrlQuery form(QString::fromUtf8(body.replace('+', "%20")));
+            for (const auto &item : form.queryItems(QUrl::FullyEncoded)) {
+                query.addQueryItem(item.first, item.second);
+            }
+            maximumLength = maximumBodyLength + environment("MAX_QUERY_LENGTH", 64 * 1024);
+        }
+        const QByteArray ifNoneMatch = request.value(QStringLiteral("If-None-Match")).toLatin1();
+        QSharedPointer<QHttpServerResponder> pending(new QHttpServerResponder(std::move(responder)));
+        QByteArray error;
+        const auto status = renderQuery(&renderPool, query, request.url(), [pending, ifNoneMatch](const ResponseCache::Entry &entry) {
+            respond(*pending, entry, ifNoneMatch);
+        }, &error, maximumLength);
+        if (status != QHttpServerResponder::StatusCode::Ok) {
+            refuse(*pending, status, error);
+        }
+    });
+
+    const QHostAddress address(parser.value(QStringLiteral("listen")));
+    int port = -1;
+    if (workers > 0) {
+        if (QTcpServer *socket = Prefork::listen(address, parser.value(QStringLiteral("port")).toUShort(), &server)) {
+            server.bind(socket);
+            port = socket->serverPort();
+        }
+    } else {
+        port = server.listen(address, parser.value(QStringLiteral("port")).toUShort());
+    }
+    if (port == -1) {
+        qDebug() << QCoreApplication::translate(
+                "MapRenderingServer", "Could not run on http://%1:%2/").arg(address.toString(), parser.value(QStringLiteral("port")));
+        return 1;
+    }
+
+    qDebug() << QCoreApplication::translate(
+            "MapRenderingServer", "Running on http://%1:%2/ (Press CTRL+C to quit)").arg(address.toString()).arg(port);
+
+    return app.exec();
+}
@@ -0,0 +1,11 @@
+TEMPLATE = app
+TARGET = qstaticmap
+CONFIG += console
+CONFIG -= app_bundle
+# next to the top level project, where it has always been
+DESTDIR = $$OUT_PWD/..
+
+include(../qstaticmap.pri)
+
+SOURCES += \
+    main.cpp
@@ -0,0 +1,231 @@
+#include "sharedtilecache.h"
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDebug>
+#include <QtCore/QtEndian>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+// The low half of the sequence is odd while the slot is written, and the
+// high half then holds when the write began; a reader that sees it odd or
+// changed across its copy has read a torn entry and misses. A slot left
+// odd for longer than any write takes belongs to a writer that died and is
+// taken over by the next one.
+struct Slot {
+    QAtomicInteger<quint64> sequence;
+    quint32 size;
+    quint32 expires;
+    quint32 stored;
+    quint64 hi;
+    quint64 lo;
+};
+
+const quint32 abandoned = 10;
+
+quint32 now()
+{
+    return static_cast<quint32>(QDateTime::currentSecsSinceEpoch());
+}
+
+bool writing(quint64 sequence)
+{
+    return sequence & 1;
+}
+
+// Returns false if the slot is busy, else the sequence to release it with.
+bool lock(Slot *slot, quint64 *release)
+{
+    const quint64 sequence = slot->sequence.loadAcquire();
+    const quint32 count = static_cast<quint32>(sequence);
+    quint32 next = count + 1;
+    if (writing(sequence)) {
+        const quint32 started = static_cast<quint32>(sequence >> 32);
+        if (now() - started < abandoned) return false;
+        next = count + 2;
+    }
+    if (!slot->sequence.testAndSetAcquire(sequence, static_cast<quint64>(now()) << 32 | next)) return false;
+    *release = static_cast<quint32>(next + 1);
+    return true;
+}
+
+}
+
+class SharedTileCache::Private
+{
+public:
+    Slot *slot(int index) const;
+    // the two slots a key may live in
+    void candidates(quint64 hi, int *first, int *second) const;
+    static void hash(const QByteArray &key, quint64 *hi, quint64 *lo);
+
+    char *memory;
+    qint64 length;
+    int slotCount;
+    int slotSize;
+    int capacity;
+
+    mutable QAtomicInteger<quint64> hits;
+    mutable QAtomicInteger<quint64> misses;
+
+    static SharedTileCache *instance;
+};
+
+SharedTileCache *SharedTileCache::Private::instance = nullptr;
+
+Slot *SharedTileCache::Private::slot(int index) const
+{
+    return reinterpret_cast<Slot *>(memory + static_cast<qint64>(index) * slotSize);
+}
+
+void SharedTileCache::Private::candidates(quint64 hi, int *first, int *second) const
+{
+    *first = static_cast<int>(hi % static_cast<quint64>(slotCount));
+    *second = (*first ^ 1) < slotCount ? *first ^ 1 : *first;
+}
+
+void SharedTileCache::Private::hash(const QByteArray &key, quint64 *hi, quint64 *lo)
+{
+    const QByteArray digest = QCryptographicHash::hash(key, QCryptographicHash::Sha1);
+    *hi = qFromBigEndian<quint64>(digest.constData());
+    *lo = qFromBigEndian<quint64>(digest.constData() + 8);
+}
+
+SharedTileCache::SharedTileCache()
+    : d(new Private)
+{
+    d->memory = nullptr;
+    d->length = 0;
+    d->slotCount = 0;
+    d->slotSize = 0;
+    d->capacity = 0;
+    d->hits = 0;
+    d->misses = 0;
+}
+
+SharedTileCache::~SharedTileCache()
+{
+#ifdef Q_OS_UNIX
+    if (d->memory) {
+        munmap(d->memory, static_cast<size_t>(d->length));
+    }
+#endif
+    delete d;
+}
+
+bool SharedTileCache::create(qint64 bytes, int slotSize)
+{
+    if (Private::instance) return true;
+#ifdef Q_OS_UNIX
+    // slots stay aligned for the atomics
+    slotSize = std::max<int>(static_cast<int>(sizeof(Slot)) + 1024, (slotSize + 63) & ~63);
+    const int slotCount = static_cast<int>(std::min<qint64>(bytes / slotSize, 1 << 24));
+    if (slotCount < 2) return false;
+    const qint64 length = static_cast<qint64>(slotCount) * slotSize;
+    void *memory = mmap(nullptr, static_cast<size_t>(length), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        qWarning() << "could not map" << length << "bytes for the shared tile cache";
+        return false;
+    }
+
+    SharedTileCache *cache = new SharedTileCache;
+    cache->d->memory = static_cast<char *>(memory);
+    cache->d->length = length;
+    cache->d->slotCount = slotCount;
+    cache->d->slotSize = slotSize;
+    cache->d->capacity = slotSize - static_cast<int>(sizeof(Slot));
+    for (int i = 0; i < slotCount; i++) {
+        new (cache->d->slot(i)) Slot();
+    }
+    Private::instance = cache;
+    return true;
+#else
+    Q_UNUSED(bytes)
+    Q_UNUSED(slotSize)
+    return false;
+#endif
+}
+
+SharedTileCache *SharedTileCache::instance()
+{
+    return Private::instance;
+}
+
+QByteArray SharedTileCache::find(const QByteArray &key) const
+{
+    quint64 hi, lo;
+    Private::hash(key, &hi, &lo);
+    int candidates[2];
+    d->candidates(hi, &candidates[0], &candidates[1]);
+
+    const quint32 current = now();
+    for (int index : candidates) {
+        const Slot *slot = d->slot(index);
+        const quint64 sequence = slot->sequence.loadAcquire();
+        if (writing(sequence)) continue;
+        const quint32 size = slot->size;
+        if (slot->hi != hi || slot->lo != lo || size == 0 || size > static_cast<quint32>(d->capacity)) continue;
+        if (slot->expires && slot->expires < current) continue;
+        const QByteArray ret(reinterpret_cast<const char *>(slot + 1), static_cast<int>(size));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->sequence.loadAcquire() != sequence) continue;
+        d->hits.fetchAndAddRelaxed(1);
+        return ret;
+    }
+    d->misses.fetchAndAddRelaxed(1);
+    return QByteArray();
+}
+
+// Replaces the same key, else an empty slot, else the older of the two.
+void SharedTileCache::insert(const QByteArray &key, const QByteArray &data, const QDateTime &expires)
+{
+    if (data.isEmpty() || data.size() > d->capacity) return;
+    quint64 hi, lo;
+    Private::hash(key, &hi, &lo);
+    int first, second;
+    d->candidates(hi, &first, &second);
+
+    Slot *a = d->slot(first);
+    Slot *b = d->slot(second);
+    Slot *slot = a;
+    if (b->hi == hi && b->lo == lo) {
+        slot = b;
+    } else if (!(a->hi == hi && a->lo == lo) && a->size != 0 && (b->size == 0 || b->stored < a->stored)) {
+        slot = b;
+    }
+
+    quint64 release;
+    if (!lock(slot, &release)) return;
+    slot->size = static_cast<quint32>(data.size());
+    slot->expires = expires.isValid() ? static_cast<quint32>(std::max<qint64>(1, expires.toSecsSinceEpoch())) : 0;
+    slot->stored = now();
+    slot->hi = hi;
+    slot->lo = lo;
+    std::memcpy(slot + 1, data.constData(), static_cast<size_t>(data.size()));
+    slot->sequence.storeRelease(release);
+}
+
+SharedTileCache::Statistics SharedTileCache::statistics() const
+{
+    Statistics ret;
+    ret.hits = d->hits.loadAcquire();
+    ret.misses = d->misses.loadAcquire();
+    ret.bytes = 0;
+    ret.count = 0;
+    for (int i = 0; i < d->slotCount; i++) {
+        const quint32 size = d->slot(i)->size;
+        if (size == 0) continue;
+        ret.bytes += size;
+        ret.count++;
+    }
+    return ret;
+}
@@ -0,0 +1,43 @@
+#ifndef SHAREDTILECACHE_H
+#define SHAREDTILECACHE_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDateTime>
+
+// Encoded tiles shared by the worker processes of --workers, in a shared
+// mapping made before the fork, so a tile fetched by one worker is there
+// for all of them and the memory does not grow with their number. The
+// mapping is split into fixed-size slots, two candidates per key; every
+// slot is guarded by a sequence lock, so readers never block and a writer
+// that finds a slot busy skips it, unless its writer died mid-write.
+class SharedTileCache
+{
+public:
+    struct Statistics {
+        quint64 hits;
+        quint64 misses;
+        qint64 bytes;
+        int count;
+    };
+
+    ~SharedTileCache();
+
+    // to be called before forking, tiles larger than a slot are not shared
+    static bool create(qint64 bytes, int slotSize);
+    // null unless created
+    static SharedTileCache *instance();
+
+    // expired tiles are not returned
+    QByteArray find(const QByteArray &key) const;
+    void insert(const QByteArray &key, const QByteArray &data, const QDateTime &expires);
+
+    Statistics statistics() const;
+
+private:
+    SharedTileCache();
+    Q_DISABLE_COPY(SharedTileCache)
+    class Private;
+    Private *d;
+};
+
+#endif // SHAREDTILECACHE_H
@@ -1,112 +1,237 @@
 #include "staticmap.h"
 
-#include <QtCore/QVariant>
-#include <QtCore/QFileInfo>
-#include <QtCore/QDir>
-#include <QtCore/QStandardPaths>
+#include "baselayercache.h"
+#include "environment.h"
+#include "imagefetcher.h"
+#include "labelcache.h"
+#include "pathprocessor.h"
+#include "tilesource.h"
+#include "viewport.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMultiHash>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
 
 #include <QtGui/QPainter>
 #include <QtGui/QFontMetrics>
 
-#include <QtNetwork/QNetworkAccessManager>
-#include <QtNetwork/QNetworkRequest>
-#include <QtNetwork/QNetworkReply>
+#include <algorithm>
+#include <cstring>
+#include <limits>
 
-#include <cmath>
+namespace {
 
-// https://github.com/systemed/tilemaker/blob/master/src/coordinates.cpp
-double deg2rad(double deg) { return (M_PI/180.0) * deg; }
-double rad2deg(double rad) { return (180.0/M_PI) * rad; }
+// Copies an opaque, unscaled tile row by row, which is what QPainter would
+// end up doing after deciding that nothing needs blending or conversion.
+bool blit(QImage *target, const QRect &rect, const QImage &image)
+{
+    if (image.format() != QImage::Format_RGB32 || image.size() != rect.size()) return false;
+    const QRect visible = rect.intersected(target->rect());
+    if (visible.isEmpty()) return true;
+    const int offset = (visible.left() - rect.left()) * 4;
+    const int bytes = visible.width() * 4;
+    for (int y = visible.top(); y <= visible.bottom(); y++) {
+        std::memcpy(target->scanLine(y) + visible.left() * 4, image.constScanLine(y - rect.top()) + offset, bytes);
+    }
+    return true;
+}
+
+// Rects already taken, bucketed into square cells so that a new label is
+// only tested against the labels around it.
+class CollisionGrid
+{
+public:
+    explicit CollisionGrid(const QSize &size)
+        : m_columns(std::max(1, (size.width() + cellSize - 1) / cellSize))
+        , m_rows(std::max(1, (size.height() + cellSize - 1) / cellSize))
+        , m_cells(m_columns * m_rows)
+    {
+    }
+
+    // Tries the rect where it is, then above, below, right and left of its
+    // center, and takes the first free position. Returns false if none is.
+    bool place(QRect *rect)
+    {
+        const int dx = rect->width() / 2 + 2;
+        const int dy = rect->height() / 2 + 2;
+        const QPoint offsets[] = { QPoint(0, 0), QPoint(0, -dy), QPoint(0, dy), QPoint(dx, 0), QPoint(-dx, 0) };
+        for (const QPoint &offset : offsets) {
+            const QRect candidate = rect->translated(offset);
+            if (!collides(candidate)) {
+                insert(candidate);
+                *rect = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static const int cellSize = 64;
 
-// Project latitude (spherical Mercator)
-// (if calling with raw coords, remember to divide/multiply by 10000000.0)
-double lat2latp(double lat) { return rad2deg(log(tan(deg2rad(lat+90.0)/2.0))); }
-double latp2lat(double latp) { return rad2deg(atan(exp(deg2rad(latp)))*2.0)-90.0; }
+    template <typename Function>
+    void forEachCell(const QRect &rect, Function function) const
+    {
+        const int left = std::max(0, std::min(m_columns - 1, rect.left() / cellSize));
+        const int right = std::max(0, std::min(m_columns - 1, rect.right() / cellSize));
+        const int top = std::max(0, std::min(m_rows - 1, rect.top() / cellSize));
+        const int bottom = std::max(0, std::min(m_rows - 1, rect.bottom() / cellSize));
+        for (int y = top; y <= bottom; y++) {
+            for (int x = left; x <= right; x++) {
+                if (!function(y * m_columns + x)) return;
+            }
+        }
+    }
+
+    bool collides(const QRect &rect) const
+    {
+        bool ret = false;
+        forEachCell(rect, [&](int cell) {
+            for (const QRect &other : m_cells.at(cell)) {
+                if (other.intersects(rect)) {
+                    ret = true;
+                    return false;
+                }
+            }
+            return true;
+        });
+        return ret;
+    }
+
+    void insert(const QRect &rect)
+    {
+        forEachCell(rect, [&](int cell) {
+            m_cells[cell].append(rect);
+            return true;
+        });
+    }
+
+    int m_columns;
+    int m_rows;
+    QVector<QVector<QRect>> m_cells;
+};
 
-// Tile conversions
-double lon2tilexf(double lon, int z) { return scalbn((lon+180.0) * (1/360.0), z); }
-double latp2tileyf(double latp, int z) { return scalbn((180.0-latp) * (1/360.0), z); }
-double lat2tileyf(double lat, int z) { return latp2tileyf(lat2latp(lat), z); }
-int lon2tilex(double lon, int z) { return static_cast<int>(lon2tilexf(lon, z)); }
-int latp2tiley(double latp, int z) { return static_cast<int>(latp2tileyf(latp, z)); }
-int lat2tiley(double lat, int z) { return static_cast<int>(lat2tileyf(lat, z)); }
-double tilex2lon(int x, int z) { return scalbn(x, -z) * 360.0 - 180.0; }
-double tiley2latp(int y, int z) { return 180.0 - scalbn(y, -z) * 360.0; }
-double tiley2lat(int y, int z) { return latp2lat(tiley2latp(y, z)); }
+}
 
 class StaticMap::Private
 {
 public:
     Private();
-    QImage tile(int x, int y, int z);
-    QImage fetch(const QUrl &url);
+    Viewport viewport() const;
+    QByteArray baseKey(const Viewport &viewport) const;
+    static const QString &urlTemplate();
+    int tileScale() const;
+
     Coordinate center;
-    int zoom;
+    qreal zoom;
     QSize size;
+    int scale;
 
-    QList<QVariant> items;
-    static QHash<QString, QImage> imageCache;
-    static QNetworkAccessManager nam;
-    QDir cacheDir;
-    QString tileUrl;
+    QVector<Image> images;
+    QVector<Text> texts;
+    QVector<Path> paths;
     QString copyright;
+    int maximumConnectionsPerHost;
+    int maximumTileZoom;
+    qreal pathTolerance;
+    QDeadlineTimer deadline;
 };
 
-QHash<QString, QImage> StaticMap::Private::imageCache;
-QNetworkAccessManager StaticMap::Private::nam;
-
 StaticMap::Private::Private()
     : zoom(0)
-    , cacheDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation))
-    , tileUrl(qEnvironmentVariable("TILE_URL", QStringLiteral("https://a.tile.openstreetmap.org/{z}/{x}/{y}.png")))
+    , scale(1)
     , copyright(qEnvironmentVariable("TILE_COPYRIGHT", QStringLiteral("© OpenStreetMap contributors")))
+    , maximumConnectionsPerHost(std::max(1, environment("MAX_CONNECTIONS_PER_HOST", 6)))
+    , maximumTileZoom(environment("TILE_MAX_ZOOM", 19))
+    , pathTolerance(0.25)
+    , deadline(QDeadlineTimer::Forever)
 {
-    if (!cacheDir.exists()) {
-        cacheDir.mkpath(".");
-    }
 }
 
-QImage StaticMap::Private::tile(int x, int y, int z)
+const QString &StaticMap::Private::urlTemplate()
+{
+    // mbtiles:// and pack:// sources address tiles by query, so the placeholders may be left out
+    static const QString ret = [] {
+        QString ret = qEnvironmentVariable("TILE_URL", QStringLiteral("https://a.tile.openstreetmap.org/{z}/{x}/{y}.png"));
+        if (!ret.contains(QStringLiteral("{z}"))) {
+            ret += QStringLiteral("?z={z}&x={x}&y={y}");
+        }
+        return ret;
+    }();
+    return ret;
+}
+
+// {s} spreads tiles over the TILE_SUBDOMAINS hosts; the choice depends on
+// the tile only, so every tile keeps a single cache key.
+QUrl StaticMap::tileUrl(int x, int y, int z, int scale)
 {
-    QString url = tileUrl;
+    static const QStringList subdomains = qEnvironmentVariable("TILE_SUBDOMAINS", QStringLiteral("a,b,c")).split(QLatin1Char(','), Qt::SkipEmptyParts);
+    QString url = Private::urlTemplate();
+    if (!subdomains.isEmpty()) {
+        url.replace(QStringLiteral("{s}"), subdomains.at(static_cast<int>((static_cast<uint>(x) + static_cast<uint>(y)) % static_cast<uint>(subdomains.size()))));
+    }
     url.replace(QStringLiteral("{x}"), QString::number(x))
             .replace(QStringLiteral("{y}"), QString::number(y))
-            .replace(QStringLiteral("{z}"), QString::number(z));
-    return fetch(QUrl(url));
+            .replace(QStringLiteral("{z}"), QString::number(z))
+            .replace(QStringLiteral("{r}"), scale > 1 ? QStringLiteral("@2x") : QString());
+    return QUrl(url);
+}
+
+// @2x tiles when the source has them and the map is rendered dense enough
+int StaticMap::Private::tileScale() const
+{
+    return scale > 1 && urlTemplate().contains(QStringLiteral("{r}")) ? 2 : 1;
+}
+
+// Two maps with the same tiles at the same pixels share a key.
+QByteArray StaticMap::Private::baseKey(const Viewport &viewport) const
+{
+    const QPointF origin = viewport.origin();
+    return urlTemplate().toUtf8() + '\x1f' + QByteArray::number(viewport.zoom(), 'g', 17)
+            + '\x1f' + QByteArray::number(origin.x(), 'f', 0) + ',' + QByteArray::number(origin.y(), 'f', 0)
+            + '\x1f' + QByteArray::number(viewport.pixelSize().width()) + 'x' + QByteArray::number(viewport.pixelSize().height())
+            + '\x1f' + QByteArray::number(viewport.scale()) + '\x1f' + QByteArray::number(tileScale())
+            + '\x1f' + QByteArray::number(maximumTileZoom);
 }
 
-QImage StaticMap::Private::fetch(const QUrl &url)
+// Without a center the map is fitted around all overlays, zooming out from
+// the requested zoom level until they fit.
+Viewport StaticMap::Private::viewport() const
 {
-    QImage ret;
-    if (url.isLocalFile()) return ret;
-
-    QString key = url.toString().toUtf8().toHex();
-    if (imageCache.contains(key)) {
-        ret = imageCache.value(key);
-    } else {
-        QString cache = QStandardPaths::locate(QStandardPaths::CacheLocation, key);
-        if (!cache.isEmpty()) {
-            ret = QImage(cache);
+    if (!qFuzzyIsNull(center.latitude()) || !qFuzzyIsNull(center.longitude())
+            || (images.isEmpty() && texts.isEmpty() && paths.isEmpty())) {
+        return Viewport(center, zoom, size, scale);
+    }
+
+    Coordinate topLeft;
+    Coordinate bottomRight;
+    bool first = true;
+    auto extend = [&](const Coordinate &coordinate) {
+        if (first) {
+            topLeft = coordinate;
+            bottomRight = coordinate;
+            first = false;
         } else {
-            QString format = QFileInfo(url.path()).suffix();
-            if (url.scheme() == QStringLiteral("qrc")) {
-                QFile file(QStringLiteral(":") + url.toString().mid(6));
-                if (file.open(QFile::ReadOnly)) {
-                    ret = QImage::fromData(file.readAll(), qPrintable(format));
-                    file.close();
-                }
-            } else {
-                QNetworkRequest request(url);
-                request.setHeader(QNetworkRequest::UserAgentHeader, QByteArrayLiteral("QGeoTileFetcher"));
-                request.setAttribute(QNetworkRequest::SynchronousRequestAttribute, true);
-                QNetworkReply *reply = nam.get(request);
-                ret = QImage::fromData(reply->readAll(), qPrintable(format));
-            }
-            ret.save(cacheDir.filePath(key), qPrintable(format));
+            topLeft.setLatitude(std::max(topLeft.latitude(), coordinate.latitude()));
+            topLeft.setLongitude(std::min(topLeft.longitude(), coordinate.longitude()));
+            bottomRight.setLatitude(std::min(bottomRight.latitude(), coordinate.latitude()));
+            bottomRight.setLongitude(std::max(bottomRight.longitude(), coordinate.longitude()));
         }
-        imageCache.insert(key, ret);
+    };
+    for (const Image &image : images) {
+        extend(image.coordinate);
     }
-    return ret;
+    for (const Text &text : texts) {
+        extend(text.coordinate);
+    }
+    for (const Path &path : paths) {
+        for (const Coordinate &coordinate : path.coordinates) {
+            extend(coordinate);
+        }
+    }
+    return Viewport::fit(topLeft, bottomRight, zoom, size, scale);
 }
 
 StaticMap::StaticMap(QObject *parent)
@@ -120,155 +245,207 @@ StaticMap::~StaticMap()
     delete d;
 }
 
-QImage StaticMap::render()
+QImage StaticMap::render(Timings *timings)
 {
-    QImage ret(d->size.width(), d->size.height(), QImage::Format_ARGB32_Premultiplied);
-    ret.fill(Qt::red);
+    QElapsedTimer elapsed;
+    elapsed.start();
+    qint64 painting = 0;
+
+    // Maps over the same viewport share their tiles: the base layer comes
+    // from the cache when it can and overlays are drawn on a copy of it.
+    // Tiles that are neither fetched nor covered by an ancestor leave the
+    // background.
+    const Viewport viewport = d->viewport();
+    const QByteArray baseKey = d->baseKey(viewport);
+    QImage ret = BaseLayerCache::instance()->find(baseKey);
+    const bool baseCached = !ret.isNull();
+    if (!baseCached) {
+        ret = QImage(viewport.pixelSize(), QImage::Format_ARGB32_Premultiplied);
+        ret.fill(QColor(0xe0, 0xe0, 0xe0));
+    }
+    bool baseComplete = true;
 
-    // determine area
-    int z = zoom();
-    Coordinate topLeft;
-    Coordinate bottomRight;
-    bool first = true;
-    for (const QVariant &item : d->items) {
-        if (item.canConvert<Image>()) {
-            Image data = item.value<Image>();
-            if (first) {
-                topLeft = data.coordinate;
-                bottomRight = data.coordinate;
-                first = false;
-            } else {
-                topLeft.setLatitude(std::max(topLeft.latitude(), data.coordinate.latitude()));
-                topLeft.setLongitude(std::min(topLeft.longitude(), data.coordinate.longitude()));
-                bottomRight.setLatitude(std::min(bottomRight.latitude(), data.coordinate.latitude()));
-                bottomRight.setLongitude(std::max(bottomRight.longitude(), data.coordinate.longitude()));
+    QPainter painter;
+    painter.begin(&ret);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+
+    // Tiles come at the level needing the least upscaling, @2x ones when the
+    // source has them. Levels beyond the source are cut out of the deepest
+    // tile it has and scaled up, and so are tiles that cannot be had from
+    // the nearest ancestor that is cached.
+    struct Placement {
+        QRect target;
+        QRectF source;
+        int x;
+        int y;
+        int z;
+    };
+    QMultiHash<QUrl, Placement> tiles;
+    const int tileScale = d->tileScale();
+    const int z = viewport.tileLevel(tileScale);
+    const int overzoom = std::max(0, z - std::max(0, d->maximumTileZoom));
+    const QRect range = baseCached ? QRect() : viewport.tiles(z);
+    const int count = 1 << std::min(z, 30);
+    for (int y = std::max(0, range.top()); y <= std::min(count - 1, range.bottom()); y++) {
+        for (int x = range.left(); x <= range.right(); x++) {
+            const int wrapped = (x % count + count) % count;
+            Placement placement;
+            placement.target = viewport.tileRect(x, y, z);
+            placement.source = QRectF(0, 0, 1, 1);
+            placement.x = wrapped;
+            placement.y = y;
+            placement.z = z;
+            if (overzoom) {
+                const double size = std::ldexp(1.0, -overzoom);
+                const int mask = (1 << overzoom) - 1;
+                placement.source = QRectF((wrapped & mask) * size, (y & mask) * size, size, size);
+                placement.x >>= overzoom;
+                placement.y >>= overzoom;
+                placement.z -= overzoom;
             }
-        } else if (item.canConvert<Text>()) {
-            Text data = item.value<Text>();
-            if (first) {
-                topLeft = data.coordinate;
-                bottomRight = data.coordinate;
-                first = false;
+            tiles.insert(tileUrl(placement.x, placement.y, placement.z, tileScale), placement);
+        }
+    }
+    // icons already in the atlas are neither looked up nor fetched again
+    MarkerAtlas *atlas = MarkerAtlas::instance();
+    QHash<QUrl, QImage> images;
+    for (const Image &image : qAsConst(d->images)) {
+        if (image.url.isEmpty() || images.contains(image.url)) continue;
+        if (atlas->icon(image.url, d->scale).isNull()) {
+            images.insert(image.url, QImage());
+        }
+    }
+
+    auto draw = [&](const Placement &placement, const QImage &image, const QRectF &part) {
+        if (part != QRectF(0, 0, 1, 1)) {
+            const QRectF source(part.x() * image.width(), part.y() * image.height(),
+                                part.width() * image.width(), part.height() * image.height());
+            painter.drawImage(QRectF(placement.target), image, source);
+        } else if (!blit(&ret, placement.target, image)) {
+            painter.drawImage(placement.target, image);
+        }
+    };
+    auto fallback = [&](const Placement &placement) {
+        for (int up = 1; up <= std::min(placement.z, 6); up++) {
+            const QImage image = ImageFetcher::cached(tileUrl(placement.x >> up, placement.y >> up, placement.z - up, tileScale));
+            if (image.isNull()) continue;
+            const double size = std::ldexp(1.0, -up);
+            const int mask = (1 << up) - 1;
+            const QRectF &part = placement.source;
+            draw(placement, image, QRectF(((placement.x & mask) + part.x()) * size, ((placement.y & mask) + part.y()) * size,
+                                          part.width() * size, part.height() * size));
+            return;
+        }
+    };
+
+    ImageFetcher fetcher;
+    fetcher.setMaximumConnectionsPerHost(d->maximumConnectionsPerHost);
+    connect(&fetcher, &ImageFetcher::imageReady, &fetcher, [&](const QUrl &url, const QImage &image) {
+        QElapsedTimer drawing;
+        drawing.start();
+        for (auto it = tiles.constFind(url); it != tiles.constEnd() && it.key() == url; ++it) {
+            if (image.isNull()) {
+                fallback(it.value());
+                baseComplete = false;
             } else {
-                topLeft.setLatitude(std::max(topLeft.latitude(), data.coordinate.latitude()));
-                topLeft.setLongitude(std::min(topLeft.longitude(), data.coordinate.longitude()));
-                bottomRight.setLatitude(std::min(bottomRight.latitude(), data.coordinate.latitude()));
-                bottomRight.setLongitude(std::max(bottomRight.longitude(), data.coordinate.longitude()));
+                draw(it.value(), image, it.value().source);
             }
-        } else if (item.canConvert<Path>()) {
-            Path data = item.value<Path>();
-            QPolygonF polygon;
-            for (const Coordinate &coordinate : data.coordinates) {
-                if (first) {
-                    topLeft = coordinate;
-                    bottomRight = coordinate;
-                    first = false;
-                } else {
-                    topLeft.setLatitude(std::max(topLeft.latitude(), coordinate.latitude()));
-                    topLeft.setLongitude(std::min(topLeft.longitude(), coordinate.longitude()));
-                    bottomRight.setLatitude(std::min(bottomRight.latitude(), coordinate.latitude()));
-                    bottomRight.setLongitude(std::max(bottomRight.longitude(), coordinate.longitude()));
-                }
-            }
-        } else {
-            qWarning() << item;
         }
+        tiles.remove(url);
+        painting += drawing.nsecsElapsed();
+        if (images.contains(url)) {
+            images.insert(url, image);
+            atlas->insertIcon(url, image, d->scale);
+        }
+    });
+    for (const QUrl &url : tiles.uniqueKeys()) {
+        fetcher.fetch(url);
     }
-
-    {
-        int tilesx = lon2tilex(topLeft.longitude(), z) - lon2tilex(bottomRight.longitude(), z);
-        int tilesy = lat2tiley(topLeft.latitude(), z) - lat2tiley(bottomRight.latitude(), z);
-        int tiles = std::max(std::abs(tilesx), std::abs(tilesy));
-        Coordinate c = center();
-        if (qFuzzyIsNull(c.latitude()) && qFuzzyIsNull(c.longitude())) {
-            Coordinate c((topLeft.latitude() + bottomRight.latitude()) / 2,
-                    (topLeft.longitude() + bottomRight.longitude()) / 2);
-            int cx = lon2tilex(c.longitude(), z);
-            int cy = lat2tiley(c.latitude(), z);
-            double w = std::abs(tilex2lon(cx + 1, z) - tilex2lon(cx, z)) * d->size.width() / 256;
-            double h = std::abs(tiley2lat(cy + 1, z) - tiley2lat(cy, z)) * d->size.height() / 256;
-            topLeft = Coordinate(c.latitude() + tiles * 0.5 * h, c.longitude() - tiles * 0.5 * w);
-            bottomRight = Coordinate(c.latitude() - tiles * 0.5 * h, c.longitude() + tiles * 0.5 * w);
-        } else {
-            // todo
-            int cx = lon2tilex(c.longitude(), z);
-            int cy = lat2tiley(c.latitude(), z);
-            double w = std::abs(tilex2lon(cx + 1, z) - tilex2lon(cx, z)) * d->size.width() / 256;
-            double h = std::abs(tiley2lat(cy + 1, z) - tiley2lat(cy, z)) * d->size.height() / 256;
-            tiles = 1;
-            topLeft = Coordinate(c.latitude() + tiles * 0.5 * h, c.longitude() - tiles * 0.5 * w);
-            bottomRight = Coordinate(c.latitude() - tiles * 0.5 * h, c.longitude() + tiles * 0.5 * w);
+    for (const QUrl &url : images.keys()) {
+        fetcher.fetch(url);
+    }
+    if (!fetcher.waitForFinished(static_cast<int>(std::min<qint64>(d->deadline.remainingTime(), std::numeric_limits<int>::max())))) {
+        fetcher.cancel();
+        for (const Placement &placement : qAsConst(tiles)) {
+            fallback(placement);
+            baseComplete = false;
         }
     }
+    const qint64 fetching = elapsed.nsecsElapsed() - painting;
+    bool iconsComplete = true;
+    for (const QImage &image : qAsConst(images)) {
+        if (image.isNull()) iconsComplete = false;
+    }
 
-    // fill tiles
-    int x1 = lon2tilex(topLeft.longitude(), z);
-    int x2 = lon2tilex(bottomRight.longitude(), z);
-    int y1 = lat2tiley(topLeft.latitude(), z);
-    int y2 = lat2tiley(bottomRight.latitude(), z);
-    int xmin = std::min(x1, x2);
-    int xmax = std::max(x1, x2) + 1;
-    int ymin = std::min(y1, y2);
-    int ymax = std::max(y1, y2) + 1;
-
-    QPainter painter;
-    painter.begin(&ret);
-    int margin = 0;
-#define LONGITUDE2X(l) \
-    ((l - topLeft.longitude()) / std::abs(topLeft.longitude() - bottomRight.longitude()) * d->size.width())
-#define LATITUDE2Y(l) \
-    ((topLeft.latitude() - l) / std::abs(topLeft.latitude() - bottomRight.latitude()) * d->size.height())
-
-    for (int y = ymin + margin; y < ymax - margin; y++) {
-        for (int x = xmin + margin; x < xmax - margin; x++) {
-            QImage tile = d->tile(x, y, z);
-            QPointF nw(LONGITUDE2X(tilex2lon(x, z)), LATITUDE2Y(tiley2lat(y, z)));
-            QPointF se(LONGITUDE2X(tilex2lon(x + 1, z)), LATITUDE2Y(tiley2lat(y + 1, z)));
-            QRect rect(std::round(nw.x()), std::round(nw.y()), std::round(se.x()) - std::round(nw.x()), std::round(se.y()) - std::round(nw.y()));
-            painter.drawImage(rect, tile);
-//            painter.drawRoundedRect(rect, 10, 10);
-        }
+    // the painter writes straight into the pixels, so it has to be restarted
+    // for the cached copy to be left alone
+    if (!baseCached && baseComplete) {
+        painter.end();
+        BaseLayerCache::instance()->insert(baseKey, ret);
+        painter.begin(&ret);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
     }
 
+    // overlays are laid out in logical pixels
+    painter.scale(d->scale, d->scale);
+
     // fill others
     painter.setRenderHint(QPainter::Antialiasing);
-    QFontMetrics f(painter.font());
-    for (const QVariant &item : d->items) {
-        if (item.canConvert<Image>()) {
-            Image data = item.value<Image>();
-            QImage image = d->fetch(data.url);
-            int w = image.width();
-            int h = image.height();
-            QPointF pos(LONGITUDE2X(data.coordinate.longitude()), LATITUDE2Y(data.coordinate.latitude()));
-            painter.drawImage(pos.x() - w / 2, pos.y() - h / 2 , image);
-        } else if (item.canConvert<Text>()) {
-            Text data = item.value<Text>();
-            int w = f.width(data.text);
-            int h = f.height() * (data.text.count(QLatin1Char('\n')) + 1);
-            QPointF pos(LONGITUDE2X(data.coordinate.longitude()), LATITUDE2Y(data.coordinate.latitude()));
-            painter.drawText(pos.x() - w / 2, pos.y() - h / 2 , w, h, Qt::AlignCenter, data.text);
-        } else if (item.canConvert<Path>()) {
-            painter.save();
-            Path data = item.value<Path>();
-            QPen pen;
-            pen.setColor(data.border.color);
-            pen.setWidth(data.border.width);
-            painter.setPen(pen);
-            painter.setBrush(data.color);
-            QPolygonF polygon;
-            for (const Coordinate &coordinate : data.coordinates) {
-                polygon.append(QPointF(LONGITUDE2X(coordinate.longitude()), LATITUDE2Y(coordinate.latitude())));
+    for (const Path &data : qAsConst(d->paths)) {
+        painter.save();
+        QPen pen;
+        pen.setColor(data.border.color);
+        pen.setWidth(data.border.width);
+        painter.setPen(pen);
+        painter.setBrush(data.color);
+        QPolygonF polygon(data.coordinates.size());
+        viewport.map(data.coordinates.constData(), data.coordinates.size(), polygon.data());
+        const qreal margin = data.border.width + 2;
+        const QRectF clip = QRectF(QPointF(0, 0), QSizeF(d->size)).adjusted(-margin, -margin, margin, margin);
+        if (data.closed) {
+            polygon = PathProcessor::simplify(PathProcessor::clipPolygon(polygon, clip), d->pathTolerance);
+            if (!polygon.isEmpty()) {
+                painter.drawPolygon(polygon);
             }
-            painter.drawPolygon(polygon);
-            painter.restore();
         } else {
-            qWarning() << item;
+            for (const QPolygonF &polyline : PathProcessor::clipPolyline(polygon, clip)) {
+                painter.drawPolyline(PathProcessor::simplify(polyline, d->pathTolerance));
+            }
+        }
+        painter.restore();
+    }
+    // markers are copied from the atlas at device pixels
+    auto sprite = [&](const Image &data) {
+        if (data.url.isEmpty()) return atlas->pin(data.color, data.size, data.label, d->scale);
+        MarkerAtlas::Sprite ret = atlas->icon(data.url, d->scale);
+        if (ret.isNull()) ret = atlas->insertIcon(data.url, images.value(data.url), d->scale);
+        return ret;
+    };
+    painter.save();
+    painter.resetTransform();
+    for (const Image &data : qAsConst(d->images)) {
+        const MarkerAtlas::Sprite marker = sprite(data);
+        if (marker.isNull()) continue;
+        const QPointF pos = viewport.map(data.coordinate) * d->scale;
+        painter.drawImage(QPoint(qRound(pos.x()), qRound(pos.y())) - marker.anchor, marker.page, marker.rect);
+    }
+    painter.restore();
+    // labels come pre-rendered from the cache; ones that cannot be placed
+    // without overlapping an earlier one are dropped
+    CollisionGrid grid(d->size);
+    for (const Text &data : qAsConst(d->texts)) {
+        const QImage label = LabelCache::instance()->label(data.text, painter.font(), painter.pen().color(), d->scale);
+        if (label.isNull()) continue;
+        const QSize size = label.size() / d->scale;
+        const QPointF pos = viewport.map(data.coordinate);
+        QRect rect(QPoint(qRound(pos.x() - size.width() / 2.0), qRound(pos.y() - size.height() / 2.0)), size);
+        if (grid.place(&rect)) {
+            painter.drawImage(rect.topLeft(), label);
         }
     }
-#undef LONGITUDE2X
-#undef LATITUDE2Y
 
     // copyrights
+    QFontMetrics f(painter.font());
     {
         int w = f.width(d->copyright) + 4;
         int h = f.height() + 2;
@@ -276,22 +453,32 @@ QImage StaticMap::render()
         painter.drawText(d->size.width() - w, d->size.height() - h, w, h, Qt::AlignCenter, d->copyright);
     }
     painter.end();
+    if (timings) {
+        timings->fetch = fetching;
+        timings->composite = elapsed.nsecsElapsed() - fetching;
+        timings->complete = baseComplete && iconsComplete;
+    }
     return ret;
 }
 
+// Icon urls come from clients, local sources are only ever read for tiles.
 void StaticMap::addImage(const Image &image)
 {
-    d->items.append(QVariant::fromValue(image));
+    if (TileSource::isLocal(image.url)) {
+        qWarning() << image.url << "not allowed for icons";
+        return;
+    }
+    d->images.append(image);
 }
 
 void StaticMap::addText(const Text &text)
 {
-    d->items.append(QVariant::fromValue(text));
+    d->texts.append(text);
 }
 
 void StaticMap::addPath(const Path &path)
 {
-    d->items.append(QVariant::fromValue(path));
+    d->paths.append(path);
 }
 
 Coordinate StaticMap::center() const
@@ -306,14 +493,14 @@ void StaticMap::setCenter(const Coordinate &center)
     emit centerChanged(center);
 }
 
-int StaticMap::zoom() const
+qreal StaticMap::zoom() const
 {
     return d->zoom;
 }
 
-void StaticMap::setZoom(int zoom)
+void StaticMap::setZoom(qreal zoom)
 {
-    if (d->zoom == zoom) return;
+    if (qFuzzyCompare(d->zoom, zoom)) return;
     d->zoom = zoom;
     emit zoomChanged(zoom);
 }
@@ -330,3 +517,43 @@ void StaticMap::setSize(const QSize &size)
     emit sizeChanged(size);
 }
 
+int StaticMap::scale() const
+{
+    return d->scale;
+}
+
+void StaticMap::setScale(int scale)
+{
+    if (d->scale == scale) return;
+    d->scale = scale;
+    emit scaleChanged(scale);
+}
+
+QDeadlineTimer StaticMap::deadline() const
+{
+    return d->deadline;
+}
+
+void StaticMap::setDeadline(const QDeadlineTimer &deadline)
+{
+    d->deadline = deadline;
+}
+
+int StaticMap::tileCount() const
+{
+    const Viewport viewport = d->viewport();
+    const int z = viewport.tileLevel(d->tileScale());
+    const QRect range = viewport.tiles(z);
+    const int count = 1 << std::min(z, 30);
+    const qint64 rows = std::max(0, std::min(count - 1, range.bottom()) - std::max(0, range.top()) + 1);
+    return static_cast<int>(std::min<qint64>(rows * range.width(), std::numeric_limits<int>::max()));
+}
+
+int StaticMap::vertexCount() const
+{
+    int ret = 0;
+    for (const Path &path : qAsConst(d->paths)) {
+        ret += path.coordinates.size();
+    }
+    return ret;
+}
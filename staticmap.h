@@ -1,47 +1,76 @@
 #ifndef STATICMAP_H
 #define STATICMAP_H
 
+#include <QtCore/QDeadlineTimer>
 #include <QtCore/QObject>
 #include <QtCore/QUrl>
+#include <QtCore/QVector>
 #include <QtGui/QImage>
 #include "coordinate.h"
+#include "markeratlas.h"
 
 class StaticMap : public QObject
 {
     Q_OBJECT
     Q_PROPERTY(Coordinate center READ center WRITE setCenter NOTIFY centerChanged)
-    Q_PROPERTY(int zoom READ zoom WRITE setZoom NOTIFY zoomChanged)
+    Q_PROPERTY(qreal zoom READ zoom WRITE setZoom NOTIFY zoomChanged)
     Q_PROPERTY(QSize size READ size WRITE setSize NOTIFY sizeChanged)
+    Q_PROPERTY(int scale READ scale WRITE setScale NOTIFY scaleChanged)
 public:
+    // a built-in pin is drawn when there is no url
     struct Image {
         QUrl url;
         Coordinate coordinate;
+        QColor color = QColor(0xea, 0x43, 0x35);
+        MarkerAtlas::PinSize size = MarkerAtlas::Mid;
+        QChar label;
     };
     struct Text {
         QString text;
         Coordinate coordinate;
     };
     struct Path {
-        QList<Coordinate> coordinates;
+        QVector<Coordinate> coordinates;
         QColor color;
         struct {
             QColor color;
-            int width;
+            int width = 1;
         } border;
+        bool closed = true;
+    };
+    // nanoseconds spent waiting for images and painting, and whether every
+    // tile and icon made it into the map
+    struct Timings {
+        qint64 fetch = 0;
+        qint64 composite = 0;
+        bool complete = true;
     };
     explicit StaticMap(QObject *parent = nullptr);
     ~StaticMap() override;
 
-    QImage render();
+    QImage render(Timings *timings = nullptr);
+
+    // images still missing at the deadline are given up on, tiles are
+    // cut out of a cached ancestor or left as a placeholder
+    QDeadlineTimer deadline() const;
+    void setDeadline(const QDeadlineTimer &deadline);
+
+    int tileCount() const;
+    int vertexCount() const;
+
+    // {r} in TILE_URL is replaced with "@2x" for a scale of 2 and more
+    static QUrl tileUrl(int x, int y, int z, int scale = 1);
 
     Coordinate center() const;
-    int zoom() const;
+    qreal zoom() const;
     QSize size() const;
+    int scale() const;
 
 public slots:
     void setCenter(const Coordinate &center);
-    void setZoom(int zoom);
+    void setZoom(qreal zoom);
     void setSize(const QSize &size);
+    void setScale(int scale);
 
     void addImage(const Image &image);
     void addText(const Text &text);
@@ -49,8 +78,9 @@ public slots:
 
 signals:
     void centerChanged(const Coordinate &center);
-    void zoomChanged(int zoom);
+    void zoomChanged(qreal zoom);
     void sizeChanged(const QSize &size);
+    void scaleChanged(int scale);
 
 private:
     class Private;
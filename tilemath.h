@@ -0,0 +1,26 @@
+#ifndef TILEMATH_H
+#define TILEMATH_H
+
+#include <cmath>
+
+// https://github.com/systemed/tilemaker/blob/master/src/coordinates.cpp
+inline double deg2rad(double deg) { return (M_PI/180.0) * deg; }
+inline double rad2deg(double rad) { return (180.0/M_PI) * rad; }
+
+// Project latitude (spherical Mercator)
+// (if calling with raw coords, remember to divide/multiply by 10000000.0)
+inline double lat2latp(double lat) { return rad2deg(log(tan(deg2rad(lat+90.0)/2.0))); }
+inline double latp2lat(double latp) { return rad2deg(atan(exp(deg2rad(latp)))*2.0)-90.0; }
+
+// Tile conversions
+inline double lon2tilexf(double lon, int z) { return scalbn((lon+180.0) * (1/360.0), z); }
+inline double latp2tileyf(double latp, int z) { return scalbn((180.0-latp) * (1/360.0), z); }
+inline double lat2tileyf(double lat, int z) { return latp2tileyf(lat2latp(lat), z); }
+inline int lon2tilex(double lon, int z) { return static_cast<int>(lon2tilexf(lon, z)); }
+inline int latp2tiley(double latp, int z) { return static_cast<int>(latp2tileyf(latp, z)); }
+inline int lat2tiley(double lat, int z) { return static_cast<int>(lat2tileyf(lat, z)); }
+inline double tilex2lon(int x, int z) { return scalbn(x, -z) * 360.0 - 180.0; }
+inline double tiley2latp(int y, int z) { return 180.0 - scalbn(y, -z) * 360.0; }
+inline double tiley2lat(int y, int z) { return latp2lat(tiley2latp(y, z)); }
+
+#endif // TILEMATH_H
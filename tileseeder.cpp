@@ -0,0 +1,260 @@
+#include "tileseeder.h"
+#include "diskcache.h"
+#include "imagefetcher.h"
+#include "staticmap.h"
+#include "tilemath.h"
+#include "viewport.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QSet>
+#include <QtCore/QTimer>
+#include <QtCore/QUrl>
+#include <QtCore/QVector>
+
+#include <algorithm>
+
+class TileSeeder::Private
+{
+public:
+    struct Area {
+        Coordinate topLeft;
+        Coordinate bottomRight;
+        Coordinate center;
+        QSize size;
+    };
+
+    Private(TileSeeder *parent);
+    QRect tiles(const Area &area, int z) const;
+    void rewind();
+    bool next(int *x, int *y, int *z);
+    void tick();
+    void report();
+
+    QVector<Area> areas;
+    int minimumZoom;
+    int maximumZoom;
+    int rate;
+    ImageFetcher fetcher;
+    QTimer timer;
+    QElapsedTimer elapsed;
+    qint64 reported;
+
+    int zoom;
+    int area;
+    QRect range;
+    int x;
+    int y;
+    bool exhausted;
+    QUrl held;
+    QSet<QUrl> inFlight;
+    double tokens;
+    qint64 total;
+    qint64 processed;
+    qint64 skipped;
+    qint64 failed;
+
+private:
+    TileSeeder *q;
+};
+
+TileSeeder::Private::Private(TileSeeder *parent)
+    : minimumZoom(0)
+    , maximumZoom(0)
+    , rate(20)
+    , reported(0)
+    , zoom(0)
+    , area(0)
+    , x(0)
+    , y(0)
+    , exhausted(false)
+    , tokens(0)
+    , total(0)
+    , processed(0)
+    , skipped(0)
+    , failed(0)
+    , q(parent)
+{
+    // expired tiles are refreshed within the run and its rate, not after it
+    fetcher.setStaleWhileRevalidate(false);
+    timer.setInterval(100);
+    QObject::connect(&timer, &QTimer::timeout, q, [this]() { tick(); });
+    QObject::connect(&fetcher, &ImageFetcher::imageReady, q, [this](const QUrl &url, const QImage &image) {
+        if (!inFlight.remove(url)) return;
+        processed++;
+        if (image.isNull()) {
+            failed++;
+            qWarning() << "failed to fetch" << url;
+        }
+    });
+}
+
+QRect TileSeeder::Private::tiles(const Area &area, int z) const
+{
+    const int count = 1 << z;
+    QRect ret;
+    if (area.size.isValid()) {
+        ret = Viewport(area.center, z, area.size).tiles(z);
+    } else {
+        const double north = std::min(area.topLeft.latitude(), 85.0511);
+        const double south = std::max(area.bottomRight.latitude(), -85.0511);
+        ret = QRect(QPoint(lon2tilex(area.topLeft.longitude(), z), lat2tiley(north, z)),
+                    QPoint(lon2tilex(area.bottomRight.longitude(), z), lat2tiley(south, z)));
+    }
+    return ret.intersected(QRect(0, 0, count, count));
+}
+
+void TileSeeder::Private::rewind()
+{
+    zoom = minimumZoom;
+    area = 0;
+    range = areas.isEmpty() ? QRect() : tiles(areas.first(), zoom);
+    x = range.left();
+    y = range.top();
+}
+
+bool TileSeeder::Private::next(int *tx, int *ty, int *tz)
+{
+    while (zoom <= maximumZoom && !areas.isEmpty()) {
+        if (!range.isEmpty() && y <= range.bottom()) {
+            *tx = x;
+            *ty = y;
+            *tz = zoom;
+            if (++x > range.right()) {
+                x = range.left();
+                y++;
+            }
+            return true;
+        }
+        if (++area >= areas.size()) {
+            area = 0;
+            if (++zoom > maximumZoom) break;
+        }
+        range = tiles(areas.at(area), zoom);
+        x = range.left();
+        y = range.top();
+    }
+    return false;
+}
+
+void TileSeeder::Private::tick()
+{
+    tokens = std::min<double>(tokens + rate / 10.0, rate);
+    const int maximumInFlight = fetcher.maximumConnectionsPerHost() * 2;
+    int checked = 0;
+    while (!exhausted && checked < 10000) {
+        if (held.isEmpty()) {
+            int tx, ty, tz;
+            if (!next(&tx, &ty, &tz)) {
+                exhausted = true;
+                break;
+            }
+            checked++;
+            const QUrl url = StaticMap::tileUrl(tx, ty, tz);
+            bool expired = false;
+            if (inFlight.contains(url) || (DiskCache::instance()->contains(url.toEncoded(), &expired) && !expired)) {
+                processed++;
+                skipped++;
+                continue;
+            }
+            held = url;
+        }
+        if (tokens < 1 || inFlight.size() >= maximumInFlight) break;
+        tokens -= 1;
+        const QUrl url = held;
+        held.clear();
+        inFlight.insert(url);
+        fetcher.fetch(url);
+    }
+
+    if (elapsed.elapsed() - reported >= 1000) {
+        report();
+    }
+    if (exhausted && inFlight.isEmpty()) {
+        timer.stop();
+        report();
+        DiskCache::instance()->sync();
+        emit q->finished();
+    }
+}
+
+void TileSeeder::Private::report()
+{
+    reported = elapsed.elapsed();
+    const double seconds = std::max<qint64>(1, reported) / 1000.0;
+    qInfo().noquote() << QStringLiteral("%1/%2 tiles (%3 already cached, %4 failed), %5 tiles/s")
+                         .arg(processed).arg(total).arg(skipped).arg(failed)
+                         .arg((processed - skipped) / seconds, 0, 'f', 1);
+}
+
+TileSeeder::TileSeeder(QObject *parent)
+    : QObject(parent)
+    , d(new Private(this))
+{
+}
+
+TileSeeder::~TileSeeder()
+{
+    delete d;
+}
+
+void TileSeeder::addArea(const Coordinate &topLeft, const Coordinate &bottomRight)
+{
+    Private::Area area;
+    area.topLeft = topLeft;
+    area.bottomRight = bottomRight;
+    d->areas.append(area);
+}
+
+void TileSeeder::addView(const Coordinate &center, const QSize &size)
+{
+    Private::Area area;
+    area.center = center;
+    area.size = size;
+    d->areas.append(area);
+}
+
+void TileSeeder::setZoomRange(int minimum, int maximum)
+{
+    d->minimumZoom = qBound(0, std::min(minimum, maximum), 30);
+    d->maximumZoom = qBound(0, std::max(minimum, maximum), 30);
+}
+
+void TileSeeder::setRate(int requestsPerSecond)
+{
+    d->rate = std::max(1, requestsPerSecond);
+}
+
+void TileSeeder::setMaximumConnectionsPerHost(int maximumConnectionsPerHost)
+{
+    d->fetcher.setMaximumConnectionsPerHost(maximumConnectionsPerHost);
+}
+
+qint64 TileSeeder::count() const
+{
+    qint64 ret = 0;
+    for (int z = d->minimumZoom; z <= d->maximumZoom; z++) {
+        for (const Private::Area &area : d->areas) {
+            const QRect range = d->tiles(area, z);
+            if (!range.isEmpty()) {
+                ret += static_cast<qint64>(range.width()) * range.height();
+            }
+        }
+    }
+    return ret;
+}
+
+void TileSeeder::start()
+{
+    d->total = count();
+    d->processed = 0;
+    d->skipped = 0;
+    d->failed = 0;
+    d->exhausted = false;
+    d->tokens = 0;
+    d->rewind();
+    d->elapsed.start();
+    d->reported = 0;
+    qInfo().noquote() << QStringLiteral("seeding %1 tiles, zoom %2-%3").arg(d->total).arg(d->minimumZoom).arg(d->maximumZoom);
+    d->timer.start();
+}
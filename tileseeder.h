@@ -0,0 +1,37 @@
+#ifndef TILESEEDER_H
+#define TILESEEDER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QSize>
+#include "coordinate.h"
+
+// Fills the disk cache with every tile of a set of areas over a range of
+// zoom levels. Tiles that are already cached and fresh are skipped, so an
+// interrupted run resumes where it stopped.
+class TileSeeder : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TileSeeder(QObject *parent = nullptr);
+    ~TileSeeder() override;
+
+    void addArea(const Coordinate &topLeft, const Coordinate &bottomRight);
+    void addView(const Coordinate &center, const QSize &size);
+    void setZoomRange(int minimum, int maximum);
+    void setRate(int requestsPerSecond);
+    void setMaximumConnectionsPerHost(int maximumConnectionsPerHost);
+
+    qint64 count() const;
+
+public slots:
+    void start();
+
+signals:
+    void finished();
+
+private:
+    class Private;
+    Private *d;
+};
+
+#endif // TILESEEDER_H
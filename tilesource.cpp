@@ -0,0 +1,300 @@
+#include "tilesource.h"
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QDirIterator>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QUrlQuery>
+#include <QtCore/QVector>
+#include <QtCore/QtEndian>
+
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+class MBTilesSource : public TileSource
+{
+public:
+    explicit MBTilesSource(const QString &fileName) : m_fileName(fileName) {}
+
+protected:
+    QByteArray tile(int x, int y, int z) override;
+
+private:
+    QString m_fileName;
+};
+
+// SQLite connections cannot be shared between threads, so every render
+// thread opens its own read-only ones. They are removed when the thread
+// finishes, and their names are never reused by a later thread.
+class Connections
+{
+public:
+    ~Connections()
+    {
+        for (const QString &name : qAsConst(m_names)) {
+            QSqlDatabase::removeDatabase(name);
+        }
+    }
+
+    QSqlDatabase database(const QString &fileName)
+    {
+        static QAtomicInteger<quint64> serial(0);
+        auto it = m_names.constFind(fileName);
+        if (it != m_names.constEnd()) return QSqlDatabase::database(it.value(), false);
+        const QString name = QStringLiteral("mbtiles-%1-%2").arg(fileName).arg(serial.fetchAndAddRelaxed(1));
+        m_names.insert(fileName, name);
+        QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), name);
+        db.setDatabaseName(fileName);
+        db.setConnectOptions(QStringLiteral("QSQLITE_OPEN_READONLY"));
+        return db;
+    }
+
+private:
+    QHash<QString, QString> m_names;
+};
+
+QByteArray MBTilesSource::tile(int x, int y, int z)
+{
+    static QThreadStorage<Connections *> connections;
+    if (!connections.hasLocalData()) {
+        connections.setLocalData(new Connections);
+    }
+    QSqlDatabase db = connections.localData()->database(m_fileName);
+    if (!db.isOpen() && !db.open()) {
+        qWarning() << m_fileName << db.lastError().text();
+        return QByteArray();
+    }
+
+    QSqlQuery query(db);
+    query.prepare(QStringLiteral("SELECT tile_data FROM tiles WHERE zoom_level = ? AND tile_column = ? AND tile_row = ?"));
+    query.addBindValue(z);
+    query.addBindValue(x);
+    // MBTiles rows follow TMS and count from the south
+    query.addBindValue((1 << z) - 1 - y);
+    if (!query.exec() || !query.next()) return QByteArray();
+    return query.value(0).toByteArray();
+}
+
+// Pack file layout, all integers little endian:
+//   header  "QSMPACK1", quint32 count, quint32 reserved
+//   index   count * { quint32 z, x, y, length; quint64 offset } sorted by z, x, y
+//   data    tiles as they were read from the directory tree
+const char packMagic[8] = { 'Q', 'S', 'M', 'P', 'A', 'C', 'K', '1' };
+const int packHeaderSize = 16;
+const int packEntrySize = 24;
+
+class PackSource : public TileSource
+{
+public:
+    explicit PackSource(const QString &fileName);
+
+protected:
+    QByteArray tile(int x, int y, int z) override;
+
+private:
+    QFile m_file;
+    const uchar *m_data;
+    qint64 m_size;
+    quint32 m_count;
+};
+
+PackSource::PackSource(const QString &fileName)
+    : m_file(fileName)
+    , m_data(nullptr)
+    , m_size(0)
+    , m_count(0)
+{
+    if (!m_file.open(QFile::ReadOnly)) {
+        qWarning() << fileName << m_file.errorString();
+        return;
+    }
+    m_size = m_file.size();
+    m_data = m_file.map(0, m_size);
+    if (!m_data || m_size < packHeaderSize || std::memcmp(m_data, packMagic, sizeof(packMagic)) != 0) {
+        qWarning() << fileName << "is not a tile pack";
+        m_data = nullptr;
+        return;
+    }
+    m_count = qFromLittleEndian<quint32>(m_data + 8);
+    if (packHeaderSize + static_cast<qint64>(m_count) * packEntrySize > m_size) {
+        qWarning() << fileName << "has a truncated index";
+        m_data = nullptr;
+    }
+}
+
+// The returned array points straight into the mapping, which lives as long
+// as the source.
+QByteArray PackSource::tile(int x, int y, int z)
+{
+    if (!m_data) return QByteArray();
+
+    const quint32 key[3] = { static_cast<quint32>(z), static_cast<quint32>(x), static_cast<quint32>(y) };
+    quint32 low = 0;
+    quint32 high = m_count;
+    while (low < high) {
+        const quint32 middle = low + (high - low) / 2;
+        const uchar *entry = m_data + packHeaderSize + static_cast<qint64>(middle) * packEntrySize;
+        int order = 0;
+        for (int i = 0; i < 3 && order == 0; i++) {
+            const quint32 value = qFromLittleEndian<quint32>(entry + i * 4);
+            order = value < key[i] ? -1 : value > key[i] ? 1 : 0;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else if (order > 0) {
+            high = middle;
+        } else {
+            const quint32 length = qFromLittleEndian<quint32>(entry + 12);
+            const quint64 offset = qFromLittleEndian<quint64>(entry + 16);
+            if (offset + length > static_cast<quint64>(m_size)) return QByteArray();
+            return QByteArray::fromRawData(reinterpret_cast<const char *>(m_data + offset), static_cast<int>(length));
+        }
+    }
+    return QByteArray();
+}
+
+QSharedPointer<TileSource> source(const QUrl &url)
+{
+    static QMutex mutex;
+    static QHash<QString, QSharedPointer<TileSource>> sources;
+
+    const QString key = url.scheme() + QLatin1Char(':') + url.path();
+    QMutexLocker locker(&mutex);
+    auto it = sources.constFind(key);
+    if (it != sources.constEnd()) return it.value();
+
+    QSharedPointer<TileSource> ret;
+    if (url.scheme() == QStringLiteral("mbtiles")) {
+        ret.reset(new MBTilesSource(url.path()));
+    } else {
+        ret.reset(new PackSource(url.path()));
+    }
+    sources.insert(key, ret);
+    return ret;
+}
+
+void writeLittleEndian(QIODevice *device, quint32 value)
+{
+    uchar data[4];
+    qToLittleEndian(value, data);
+    device->write(reinterpret_cast<const char *>(data), sizeof(data));
+}
+
+void writeLittleEndian(QIODevice *device, quint64 value)
+{
+    uchar data[8];
+    qToLittleEndian(value, data);
+    device->write(reinterpret_cast<const char *>(data), sizeof(data));
+}
+
+}
+
+TileSource::~TileSource()
+{
+}
+
+bool TileSource::isLocal(const QUrl &url)
+{
+    return url.isLocalFile() || url.scheme() == QStringLiteral("mbtiles") || url.scheme() == QStringLiteral("pack");
+}
+
+QByteArray TileSource::read(const QUrl &url, qint64 maximumSize)
+{
+    // devices and pipes have no size, so one byte more than allowed is read
+    if (url.isLocalFile()) {
+        QFile file(url.toLocalFile());
+        if (!file.open(QFile::ReadOnly) || file.size() > maximumSize) return QByteArray();
+        const QByteArray ret = file.read(maximumSize + 1);
+        return ret.size() > maximumSize ? QByteArray() : ret;
+    }
+
+    const QUrlQuery query(url);
+    bool okx, oky, okz;
+    int x = query.queryItemValue(QStringLiteral("x")).toInt(&okx);
+    int y = query.queryItemValue(QStringLiteral("y")).toInt(&oky);
+    int z = query.queryItemValue(QStringLiteral("z")).toInt(&okz);
+    if (!okx || !oky || !okz || z < 0 || z > 30) return QByteArray();
+    const QByteArray ret = source(url)->tile(x, y, z);
+    return ret.size() > maximumSize ? QByteArray() : ret;
+}
+
+bool TileSource::writePack(const QString &directory, const QString &fileName)
+{
+    struct Item {
+        quint32 z;
+        quint32 x;
+        quint32 y;
+        quint32 length;
+        QString path;
+    };
+    QVector<Item> items;
+    const QDir root(directory);
+    QDirIterator it(directory, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        const QString path = it.next();
+        const QStringList parts = root.relativeFilePath(path).split(QLatin1Char('/'));
+        if (parts.length() != 3) continue;
+        bool ok1, ok2, ok3;
+        Item item;
+        item.z = parts[0].toUInt(&ok1);
+        item.x = parts[1].toUInt(&ok2);
+        item.y = QFileInfo(parts[2]).baseName().toUInt(&ok3);
+        item.length = static_cast<quint32>(it.fileInfo().size());
+        item.path = path;
+        if (ok1 && ok2 && ok3) items.append(item);
+    }
+    std::sort(items.begin(), items.end(), [](const Item &a, const Item &b) {
+        if (a.z != b.z) return a.z < b.z;
+        if (a.x != b.x) return a.x < b.x;
+        return a.y < b.y;
+    });
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << fileName << file.errorString();
+        return false;
+    }
+    file.write(packMagic, sizeof(packMagic));
+    writeLittleEndian(&file, static_cast<quint32>(items.size()));
+    writeLittleEndian(&file, quint32(0));
+
+    quint64 offset = packHeaderSize + static_cast<quint64>(items.size()) * packEntrySize;
+    for (const Item &item : items) {
+        writeLittleEndian(&file, item.z);
+        writeLittleEndian(&file, item.x);
+        writeLittleEndian(&file, item.y);
+        writeLittleEndian(&file, item.length);
+        writeLittleEndian(&file, offset);
+        offset += item.length;
+    }
+    for (const Item &item : items) {
+        QFile tile(item.path);
+        if (!tile.open(QFile::ReadOnly)) {
+            qWarning() << item.path << tile.errorString();
+            file.cancelWriting();
+            return false;
+        }
+        const QByteArray data = tile.readAll();
+        if (static_cast<quint32>(data.size()) != item.length) {
+            qWarning() << item.path << "changed while packing";
+            file.cancelWriting();
+            return false;
+        }
+        file.write(data);
+    }
+    qInfo().noquote() << QStringLiteral("packed %1 tiles into %2").arg(items.size()).arg(fileName);
+    return file.commit();
+}
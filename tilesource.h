@@ -0,0 +1,27 @@
+#ifndef TILESOURCE_H
+#define TILESOURCE_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QUrl>
+
+// Local tile backends selected by the scheme of TILE_URL:
+//   file:///srv/tiles/{z}/{x}/{y}.png   directory tree
+//   mbtiles:///srv/world.mbtiles        MBTiles (SQLite)
+//   pack:///srv/world.pack              memory-mapped pack file
+class TileSource
+{
+public:
+    virtual ~TileSource();
+
+    static bool isLocal(const QUrl &url);
+    // tiles over maximumSize bytes are not read
+    static QByteArray read(const QUrl &url, qint64 maximumSize);
+
+    // Packs a {z}/{x}/{y}.ext directory tree into a pack file.
+    static bool writePack(const QString &directory, const QString &fileName);
+
+protected:
+    virtual QByteArray tile(int x, int y, int z) = 0;
+};
+
+#endif // TILESOURCE_H
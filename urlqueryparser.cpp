@@ -1,16 +1,135 @@
 #include "urlqueryparser.h"
-#include <QtCore/QDebug>
 
-void UrlQueryParser::parse(const QString &query, const KeyValueCallback &keyValue, const CoordinateCallback &coordinate)
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+inline bool isDigit(QChar c)
+{
+    return c.unicode() >= '0' && c.unicode() <= '9';
+}
+
+bool parseInt(QStringView text, int *value)
+{
+    if (text.isEmpty()) return false;
+    qint64 ret = 0;
+    for (QChar c : text) {
+        if (!isDigit(c)) return false;
+        ret = ret * 10 + (c.unicode() - '0');
+        if (ret > std::numeric_limits<int>::max()) return false;
+    }
+    *value = static_cast<int>(ret);
+    return true;
+}
+
+QStringView trimmed(QStringView text)
+{
+    const QChar *begin = text.begin();
+    const QChar *end = text.end();
+    while (begin != end && begin->isSpace()) ++begin;
+    while (end != begin && (end - 1)->isSpace()) --end;
+    return QStringView(begin, end);
+}
+
+}
+
+// Decimal numbers whose digits fit in 53 bits and whose exponent is at
+// most 22 are exact as one multiplication or division of two doubles,
+// which covers coordinates. Anything else goes through QString::toDouble().
+bool UrlQueryParser::parseDouble(QStringView text, double *value)
 {
-    for (const QString &item : query.split(QLatin1Char('|'))) {
-        int colon = item.indexOf(QLatin1Char(':'));
-        if (colon > -1) {
-            keyValue(item.left(colon), item.mid(colon + 1));
-        } else if (item.contains(QLatin1Char(','))) {
-            coordinate(Coordinate(item));
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    text = trimmed(text);
+    const QChar *it = text.begin();
+    const QChar *end = text.end();
+    bool negative = false;
+    if (it != end && (*it == QLatin1Char('-') || *it == QLatin1Char('+'))) {
+        negative = *it == QLatin1Char('-');
+        ++it;
+    }
+
+    quint64 mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    for (; it != end && isDigit(*it); ++it) {
+        any = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + static_cast<quint64>(it->unicode() - '0');
+            if (mantissa) digits++;
         } else {
-            qWarning() << item;
+            exponent++;
+        }
+    }
+    if (it != end && *it == QLatin1Char('.')) {
+        for (++it; it != end && isDigit(*it); ++it) {
+            any = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + static_cast<quint64>(it->unicode() - '0');
+                if (mantissa) digits++;
+                exponent--;
+            }
+        }
+    }
+    if (!any) return false;
+    if (it != end && (*it == QLatin1Char('e') || *it == QLatin1Char('E'))) {
+        ++it;
+        bool negativeExponent = false;
+        if (it != end && (*it == QLatin1Char('-') || *it == QLatin1Char('+'))) {
+            negativeExponent = *it == QLatin1Char('-');
+            ++it;
+        }
+        if (it == end) return false;
+        int e = 0;
+        for (; it != end && isDigit(*it); ++it) {
+            if (e < 100000) e = e * 10 + (it->unicode() - '0');
         }
+        exponent += negativeExponent ? -e : e;
+    }
+    if (it != end) return false;
+
+    double ret;
+    if (mantissa <= (Q_UINT64_C(1) << 53) && exponent >= -22 && exponent <= 22) {
+        ret = static_cast<double>(mantissa);
+        ret = exponent < 0 ? ret / powers[-exponent] : ret * powers[exponent];
+        if (negative) ret = -ret;
+    } else {
+        bool ok;
+        ret = text.toString().toDouble(&ok);
+        if (!ok) return false;
+    }
+    *value = ret;
+    return true;
+}
+
+bool UrlQueryParser::parseCoordinate(QStringView text, Coordinate *coordinate)
+{
+    const QChar *comma = std::find(text.begin(), text.end(), QLatin1Char(','));
+    if (comma == text.end()) return false;
+    double latitude;
+    double longitude;
+    if (!parseDouble(QStringView(text.begin(), comma), &latitude)
+            || !parseDouble(QStringView(comma + 1, text.end()), &longitude)) {
+        return false;
+    }
+    *coordinate = Coordinate(latitude, longitude);
+    return true;
+}
+
+bool UrlQueryParser::parseSize(QStringView text, QSize *size)
+{
+    const QChar *x = std::find(text.begin(), text.end(), QLatin1Char('x'));
+    if (x == text.end()) return false;
+    int width;
+    int height;
+    if (!parseInt(QStringView(text.begin(), x), &width) || !parseInt(QStringView(x + 1, text.end()), &height)) {
+        return false;
     }
+    *size = QSize(width, height);
+    return true;
 }
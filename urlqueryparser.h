@@ -1,16 +1,101 @@
 #ifndef URLQUERYPARSER_H
 #define URLQUERYPARSER_H
 
-#include <functional>
-#include <QtCore/QString>
+#include <QtCore/QDebug>
+#include <QtCore/QSize>
+#include <QtCore/QStringView>
 #include "coordinate.h"
 
+// Parses "key:value|lat,lng|..." in one pass over the string without
+// copying it: keyValue(QStringView key, QStringView value) is called for
+// every key:value item and coordinate(const Coordinate &) for every point.
+// "enc:" starts a Google encoded polyline that runs to the end of the
+// query, since it may contain '|'.
 class UrlQueryParser
 {
 public:
-    typedef std::function<void(const QString &key, const QString &value)> KeyValueCallback;
-    typedef std::function<void(const Coordinate &coordinate)> CoordinateCallback;
-    static void parse(const QString &query, const KeyValueCallback &keyValue, const CoordinateCallback &coordinate);
+    template <typename KeyValueCallback, typename CoordinateCallback>
+    static void parse(QStringView query, KeyValueCallback &&keyValue, CoordinateCallback &&coordinate);
+
+    // precision 5, as produced by the Google polyline encoder
+    template <typename CoordinateCallback>
+    static bool decodePolyline(QStringView polyline, CoordinateCallback &&coordinate);
+
+    static bool parseDouble(QStringView text, double *value);
+    static bool parseCoordinate(QStringView text, Coordinate *coordinate);
+    // "WxH"
+    static bool parseSize(QStringView text, QSize *size);
 };
 
-#endif // URLQUERYPARSER_H
\ No newline at end of file
+template <typename KeyValueCallback, typename CoordinateCallback>
+void UrlQueryParser::parse(QStringView query, KeyValueCallback &&keyValue, CoordinateCallback &&coordinate)
+{
+    const QChar *end = query.end();
+    const QChar *item = query.begin();
+    while (true) {
+        const QChar *colon = nullptr;
+        const QChar *comma = nullptr;
+        const QChar *it = item;
+        for (; it != end && *it != QLatin1Char('|'); ++it) {
+            if (!colon && *it == QLatin1Char(':')) {
+                colon = it;
+            } else if (!comma && *it == QLatin1Char(',')) {
+                comma = it;
+            }
+        }
+
+        if (colon) {
+            const QStringView key(item, colon);
+            if (key == QLatin1String("enc")) {
+                if (!decodePolyline(QStringView(colon + 1, end), coordinate)) {
+                    qWarning() << "invalid encoded polyline";
+                }
+                return;
+            }
+            keyValue(key, QStringView(colon + 1, it));
+        } else if (comma) {
+            Coordinate point;
+            if (parseCoordinate(QStringView(item, it), &point)) {
+                coordinate(point);
+            } else {
+                qWarning() << QStringView(item, it);
+            }
+        } else if (it != item) {
+            qWarning() << QStringView(item, it);
+        }
+        if (it == end) break;
+        item = it + 1;
+    }
+}
+
+template <typename CoordinateCallback>
+bool UrlQueryParser::decodePolyline(QStringView polyline, CoordinateCallback &&coordinate)
+{
+    qint64 latitude = 0;
+    qint64 longitude = 0;
+    const QChar *it = polyline.begin();
+    const QChar *end = polyline.end();
+    while (it != end) {
+        qint64 delta[2];
+        for (qint64 &value : delta) {
+            quint64 bits = 0;
+            int shift = 0;
+            int chunk = 0;
+            do {
+                if (it == end || shift > 60) return false;
+                chunk = it->unicode() - 63;
+                ++it;
+                if (chunk < 0 || chunk > 63) return false;
+                bits |= static_cast<quint64>(chunk & 0x1f) << shift;
+                shift += 5;
+            } while (chunk & 0x20);
+            value = bits & 1 ? ~static_cast<qint64>(bits >> 1) : static_cast<qint64>(bits >> 1);
+        }
+        latitude += delta[0];
+        longitude += delta[1];
+        coordinate(Coordinate(latitude / 1e5, longitude / 1e5));
+    }
+    return true;
+}
+
+#endif // URLQUERYPARSER_H
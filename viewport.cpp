@@ -0,0 +1,74 @@
+#include "viewport.h"
+#include "tilemath.h"
+
+#include <QtCore/QVarLengthArray>
+
+#include <algorithm>
+
+Viewport::Viewport(const Coordinate &center, qreal zoom, const QSize &size, int scale)
+    : m_center(center)
+    , m_zoom(zoom)
+    , m_size(size)
+    , m_scale(scale)
+    , m_world(std::exp2(zoom) * tileSize * scale)
+    , m_left(std::round(lon2tilexf(center.longitude(), 0) * m_world - size.width() * scale / 2.0))
+    , m_top(std::round(lat2tileyf(center.latitude(), 0) * m_world - size.height() * scale / 2.0))
+{
+}
+
+Viewport Viewport::fit(const Coordinate &topLeft, const Coordinate &bottomRight, qreal maximumZoom, const QSize &size, int scale)
+{
+    const double top = lat2latp(topLeft.latitude());
+    const double bottom = lat2latp(bottomRight.latitude());
+    const Coordinate center(latp2lat((top + bottom) / 2), (topLeft.longitude() + bottomRight.longitude()) / 2);
+    qreal zoom = maximumZoom;
+    for (; zoom > 0; zoom -= 1) {
+        const double pixelsPerDegree = std::exp2(zoom) * tileSize / 360.0;
+        if ((bottomRight.longitude() - topLeft.longitude()) * pixelsPerDegree <= size.width()
+                && (top - bottom) * pixelsPerDegree <= size.height()) {
+            break;
+        }
+    }
+    return Viewport(center, std::max<qreal>(0, zoom), size, scale);
+}
+
+QPointF Viewport::map(const Coordinate &coordinate) const
+{
+    return QPointF((lon2tilexf(coordinate.longitude(), 0) * m_world - m_left) / m_scale,
+                   (lat2tileyf(coordinate.latitude(), 0) * m_world - m_top) / m_scale);
+}
+
+void Viewport::map(const Coordinate *coordinates, int count, QPointF *points) const
+{
+    // Mercator is linear in longitude and in projected latitude: project the
+    // latitudes first and let Coordinate::project() do the affine part.
+    QVarLengthArray<Coordinate, 256> projected(count);
+    for (int i = 0; i < count; i++) {
+        projected[i] = Coordinate(lat2latp(coordinates[i].latitude()), coordinates[i].longitude());
+    }
+    const double pixelsPerDegree = m_world / m_scale / 360.0;
+    const Coordinate origin(180.0 - m_top / m_scale / pixelsPerDegree, m_left / m_scale / pixelsPerDegree - 180.0);
+    Coordinate::project(projected.constData(), count, origin, pixelsPerDegree, pixelsPerDegree, points);
+}
+
+int Viewport::tileLevel(int tileScale) const
+{
+    return std::max(0, static_cast<int>(std::floor(m_zoom + std::log2(static_cast<double>(m_scale) / tileScale) + 1e-9)));
+}
+
+QRect Viewport::tiles(int level) const
+{
+    const double size = std::ldexp(m_world, -level);
+    return QRect(QPoint(static_cast<int>(std::floor(m_left / size)),
+                        static_cast<int>(std::floor(m_top / size))),
+                 QPoint(static_cast<int>(std::floor((m_left + m_size.width() * m_scale - 1) / size)),
+                        static_cast<int>(std::floor((m_top + m_size.height() * m_scale - 1) / size))));
+}
+
+QRect Viewport::tileRect(int x, int y, int level) const
+{
+    const double size = std::ldexp(m_world, -level);
+    const int left = qRound(x * size - m_left);
+    const int top = qRound(y * size - m_top);
+    return QRect(left, top, qRound((x + 1) * size - m_left) - left, qRound((y + 1) * size - m_top) - top);
+}
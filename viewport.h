@@ -0,0 +1,52 @@
+#ifndef VIEWPORT_H
+#define VIEWPORT_H
+
+#include <QtCore/QPointF>
+#include <QtCore/QRect>
+#include <QtCore/QSize>
+#include "coordinate.h"
+
+// Maps coordinates to pixels of the output image in spherical Mercator
+// space. The zoom may be fractional and the image may be rendered at an
+// integer scale for high density displays. The top left corner is snapped
+// to whole image pixels so that tiles land on an integer grid.
+class Viewport
+{
+public:
+    static const int tileSize = 256;
+
+    Viewport(const Coordinate &center, qreal zoom, const QSize &size, int scale = 1);
+
+    static Viewport fit(const Coordinate &topLeft, const Coordinate &bottomRight, qreal maximumZoom, const QSize &size, int scale = 1);
+
+    Coordinate center() const { return m_center; }
+    qreal zoom() const { return m_zoom; }
+    QSize size() const { return m_size; }
+    int scale() const { return m_scale; }
+    QSize pixelSize() const { return m_size * m_scale; }
+    // the top left corner of the image in world pixels
+    QPointF origin() const { return QPointF(m_left, m_top); }
+
+    // in logical pixels, multiply by scale() for image pixels
+    QPointF map(const Coordinate &coordinate) const;
+    void map(const Coordinate *coordinates, int count, QPointF *points) const;
+
+    // the tile zoom level needing the least upscaling when tiles are
+    // tileScale * tileSize pixels large
+    int tileLevel(int tileScale = 1) const;
+    // tiles overlapping the image; x may exceed the world and has to be wrapped
+    QRect tiles(int level) const;
+    // in image pixels, adjacent tiles share their edges
+    QRect tileRect(int x, int y, int level) const;
+
+private:
+    Coordinate m_center;
+    qreal m_zoom;
+    QSize m_size;
+    int m_scale;
+    double m_world;
+    double m_left;
+    double m_top;
+};
+
+#endif // VIEWPORT_H